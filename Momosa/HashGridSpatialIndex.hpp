@@ -1,220 +1,333 @@
 
 #pragma once
 
-#include <unordered_map>
 #include <vector>
 #include <algorithm>
+#include <cmath>
 #include <assert.h>
 
-#include "point_util.h"
-
-#include <intrin.h>
- #pragma intrinsic(_mm_cvt_ss2si)
- #pragma intrinsic(_mm_set_sd)
-
-inline
-int fround(float val)
-{
-    return _mm_cvt_ss2si(_mm_set_ss(val));
-}
-
-inline
-float minss (float a, float b)
-{
-    _mm_store_ss(&a, _mm_min_ss(_mm_set_ss(a),_mm_set_ss(b)));
-    return a;
-}
-
-inline
-float maxss ( float a, float b )
-{
-    _mm_store_ss(&a, _mm_max_ss(_mm_set_ss(a),_mm_set_ss(b)));
-    return a;
-}
-
-inline
-float clamp (float val, float minval, float maxval)
-{
-    _mm_store_ss(&val, _mm_min_ss(_mm_max_ss(_mm_set_ss(val), _mm_set_ss(minval)), _mm_set_ss(maxval)));
-    return val;
-}
-
+#include <ppl.h>
+
+#include "OccupancyGrid.hpp"
+#include "point_utils.hpp"
+#include "query_filters.hpp"
+#include "regions.hpp"
+
+//
+// Dense multi level grid in CSR form.  The points are in one array grouped by cell and in rank order within each cell.
+// A cell holds the range of its points, their min rank, mbr and ids.  All grids share one array of cells, in row major
+// order per grid.
+//
+// The resolution follows the density of the points.  Each grid is sized from its number of points and the aspect of its
+// bounds for about target_bin_size points per cell.  Cells that still hold more than max_bin_size points, where the
+// points cluster, are split again by a child grid over their mbr, down to max_height.
+//
+// A query walks the grids overlapping the rect with a stack, collects the leaf cells intersecting it and scans them
+// lowest rank first.  Cells whose points all miss the rect, see OccupancyGrid, are not collected.
+//
 class HashGridSpatialIndex
 {
 public:
     template <typename Iterator>
     HashGridSpatialIndex(Iterator first, Iterator last, Rect const& mbr)
-        : m_num_bins(0)
-        , m_num_entries(0)
-        , m_num_objects(0)
+        : m_points(first, last)
     {
-        extend_mbr(first, last, m_hashgrid);
+        if(m_points.empty()) { return; }
 
-        partition_hashgrid(first, last, m_hashgrid, 1);
+        // The partitioning below is stable, so the points of each cell stay in rank order.
+        concurrency::parallel_sort(m_points.begin(), m_points.end());
 
-        sort_bin(m_hashgrid);
+        build_grid(mbr, 0, static_cast<uint32_t>(m_points.size()), 0);
     }
 
-    template<typename OutIter>
-    void query(Rect const& region, OutIter out)
+    template<typename Region, typename OutIter>
+    void query(Region const& region, OutIter& out)
     {
-        search(m_hashgrid, region, out);
+        search(region, out, no_filter());
     }
 
-private:
-    struct Bin
+    template<typename Region, typename OutIter, typename Filter>
+    void query(Region const& region, OutIter& out, Filter const& filter)
     {
-        Bin() 
-            : rank(std::numeric_limits<int32_t>::max())
+        search(region, out, filter);
+    }
+
+    // Number of points inside the region.  Cells contained by the region add their size without being scanned.
+    std::size_t count(Rect const& region) const
+    {
+        if(m_grids.empty()) { return 0; }
+
+        std::size_t result = 0;
+
+        std::vector<uint32_t> grid_stack(1, 0);
+        while(!grid_stack.empty())
         {
-            initialize(mbr);
+            auto const& grid = m_grids[grid_stack.back()];
+            grid_stack.pop_back();
+
+            if(!intersects(grid.bounds, region)) { continue; }
+
+            for_each_cell(grid, region, [&](Cell const& cell, uint32_t)
+            {
+                if(!intersects(region, cell.mbr) || !cell.occupancy.intersects(cell.mbr, region)) { return; }
+
+                if(contains(region, cell.mbr))
+                {
+                    result += cell.last - cell.first;
+                }
+                else if(cell.child >= 0)
+                {
+                    grid_stack.push_back(static_cast<uint32_t>(cell.child));
+                }
+                else
+                {
+                    result += std::count_if(m_points.begin() + cell.first, m_points.begin() + cell.last, [&](Point const& p) { return contains(region, p); });
+                }
+            });
         }
 
-        bool is_leaf() const { return !leaf.empty(); }
+        return result;
+    }
+
+    int32_t get_min_rank() const { return m_points.empty() ? std::numeric_limits<int32_t>::max() : m_points.front().rank; }
+
+    std::size_t size() const { return m_points.size(); }
 
+private:
+    struct Cell
+    {
+        uint32_t first;     // Range of the points in m_points, split over the child grid if there is one.
+        uint32_t last;
+        int32_t child;      // Grid splitting the cell, or -1 for a leaf cell.
         int32_t rank;
+        int32_t max_rank;
         Rect mbr;
-
-        std::unordered_map<int64_t, Bin> nodes;
-        std::vector<Point> leaf;
+        OccupancyGrid occupancy;
+        id_set ids;
     };
 
+    struct Grid
+    {
+        Rect bounds;
+        float scale[2];
+        uint32_t bins[2];
+        uint32_t first_cell;
+    };
 
 private:
-    template <typename Iterator>
-    void extend_mbr(Iterator first, Iterator last, Bin& hashgrid)
+    // Partitions the points in [first, last) over a new grid and returns its index.
+    uint32_t build_grid(Rect const& bounds, uint32_t const first, uint32_t const last, int const height)
     {
-        for(;first != last; ++first)
+        Grid grid;
+        grid.bounds = bounds;
+        choose_bins(bounds, last - first, grid.bins);
+        grid.scale[0] = bounds.hx > bounds.lx ? grid.bins[0] / (bounds.hx - bounds.lx) : 0.0f;
+        grid.scale[1] = bounds.hy > bounds.ly ? grid.bins[1] / (bounds.hy - bounds.ly) : 0.0f;
+        grid.first_cell = static_cast<uint32_t>(m_cells.size());
+
+        const auto num_cells = grid.bins[0] * grid.bins[1];
+
+        const auto g = static_cast<uint32_t>(m_grids.size());
+        m_grids.push_back(grid);
+        m_cells.resize(m_cells.size() + num_cells);
+
+        // Counting sort of the points by cell.
+        std::vector<uint32_t> keys(last - first);
+        std::vector<uint32_t> offsets(num_cells + 1, 0);
+        for(auto i = first; i < last; ++i)
         {
-            extend_bounds(hashgrid.mbr, *first);
+            keys[i - first] = cell_key(grid, m_points[i]);
+            ++offsets[keys[i - first] + 1];
         }
-    }
 
-    template <typename Iterator>
-    void partition_hashgrid(Iterator first, Iterator last, Bin& bin, int height)
-    {
-        if(std::distance(first, last) < max_bin_size) { return; }
+        for(std::size_t c = 1; c < offsets.size(); ++c)
+        {
+            offsets[c] += offsets[c - 1];
+        }
 
-        const auto& mbr = bin.mbr;
+        {
+            std::vector<Point> sorted(last - first);
+            auto next = offsets;
+            for(auto i = first; i < last; ++i)
+            {
+                sorted[next[keys[i - first]]++] = m_points[i];
+            }
+
+            std::copy(sorted.begin(), sorted.end(), m_points.begin() + first);
+        }
 
-        for(; first != last; ++first)
+        for(uint32_t key = 0; key < num_cells; ++key)
         {
-            const auto& point = *first;
-            const auto x_key = fround((point.x - mbr.lx) * (num_bins / (mbr.hx - mbr.lx)));
-            const auto y_key = fround((point.y - mbr.ly) * (num_bins / (mbr.hy - mbr.ly)));
-            assert(x_key >= 0 && y_key >= 0);
+            const auto c = grid.first_cell + key;
 
-            const auto key = generate_key(x_key, y_key);
+            Cell cell;
+            cell.first = first + offsets[key];
+            cell.last = first + offsets[key + 1];
+            cell.child = -1;
+            cell.rank = std::numeric_limits<int32_t>::max();
+            cell.max_rank = std::numeric_limits<int32_t>::lowest();
+            initialize(cell.mbr);
 
-            auto& b = bin.nodes[key];
-            b.leaf.push_back(point);
-            extend_bounds(b.mbr, point);
-            bin.rank = std::min(bin.rank, point.rank);
-        }
+            for(auto i = cell.first; i < cell.last; ++i)
+            {
+                auto const& p = m_points[i];
+                extend_bounds(cell.mbr, p);
+                cell.rank = std::min(cell.rank, p.rank);
+                cell.max_rank = std::max(cell.max_rank, p.rank);
+                cell.ids.insert(p.id);
+            }
 
-        if(height > max_height) { return; }
+            for(auto i = cell.first; i < cell.last; ++i)
+            {
+                cell.occupancy.add(cell.mbr, m_points[i]);
+            }
 
-        for(auto& n : bin.nodes)
-        {
-            auto& b = n.second;
-            if(b.leaf.size() > max_bin_size)
+            m_cells[c] = cell;
+
+            // A grid of a single cell, all of its points at one location, cannot split them further.
+            if(cell.last - cell.first > max_bin_size && height < max_height && num_cells > 1)
             {
-                partition_hashgrid(b.leaf.begin(), b.leaf.end(), b, height + 1);
-                b.leaf.clear();
-                b.leaf.shrink_to_fit();
+                const auto child = build_grid(cell.mbr, cell.first, cell.last, height + 1);
+                m_cells[c].child = static_cast<int32_t>(child);
             }
         }
+
+        return g;
     }
 
-    void sort_bin(Bin& hashgrid)
+    // Bins along each axis for about target_bin_size points per cell, in proportion to the sides of the bounds.
+    static void choose_bins(Rect const& bounds, uint32_t const num_points, uint32_t bins[2])
     {
-        if(hashgrid.is_leaf())
+        const double w = bounds.hx - bounds.lx;
+        const double h = bounds.hy - bounds.ly;
+        const double num_cells = std::max(1.0, static_cast<double>(num_points) / target_bin_size);
+
+        double bx = 1.0;
+        double by = 1.0;
+        if(w > 0.0 && h > 0.0)
         {
-            concurrency::parallel_sort(hashgrid.leaf.begin(), hashgrid.leaf.end());
-            return;
+            bx = std::sqrt(num_cells * w / h);
+            by = num_cells / std::max(1.0, std::min<double>(bx, max_bins));
         }
-
-        for(auto& b : hashgrid.nodes)
+        else if(w > 0.0)
+        {
+            bx = num_cells;
+        }
+        else if(h > 0.0)
         {
-            sort_bin(b.second);
+            by = num_cells;
         }
+
+        bins[0] = static_cast<uint32_t>(std::max(1.0, std::min<double>(std::ceil(bx), max_bins)));
+        bins[1] = static_cast<uint32_t>(std::max(1.0, std::min<double>(std::ceil(by), max_bins)));
     }
 
-    template<typename OutIter> inline static
-    void search(Bin const& hashgrid, Rect const& region, OutIter out)
+    template<std::size_t I>
+    static uint32_t cell_coord(Grid const& grid, float v)
     {
-        if(hashgrid.nodes.empty() && hashgrid.leaf.empty()) { return; }
+        const auto q = (v - get_dim_coord_lo<I>(grid.bounds)) * grid.scale[I];
+        if(!(q > 0.0f)) { return 0; }
+        if(q >= grid.bins[I] - 1) { return grid.bins[I] - 1; }
 
-        const auto& mbr = hashgrid.mbr;
+        return static_cast<uint32_t>(q);
+    }
 
-        if(!intersects(mbr, region)) { return; }
+    static uint32_t cell_key(Grid const& grid, Point const& p)
+    {
+        return cell_coord<1>(grid, p.y) * grid.bins[0] + cell_coord<0>(grid, p.x);
+    }
 
-        if(hashgrid.is_leaf())
+    // Calls f(cell, index) for the cells of grid overlapping the bounds.
+    template<typename F>
+    void for_each_cell(Grid const& grid, Rect const& bounds, F f) const
+    {
+        const auto x_lo = cell_coord<0>(grid, bounds.lx);
+        const auto x_hi = cell_coord<0>(grid, bounds.hx);
+        const auto y_lo = cell_coord<1>(grid, bounds.ly);
+        const auto y_hi = cell_coord<1>(grid, bounds.hy);
+
+        for(auto y = y_lo; y <= y_hi; ++y)
         {
-            for (auto& p : hashgrid.leaf)
+            const auto row = grid.first_cell + y * grid.bins[0];
+            for(auto x = x_lo; x <= x_hi; ++x)
             {
-                if (p.rank > out.get_max_rank()) { return; }
-                if (contains(region, p))
-                {
-                    *out = p;
-                }
+                f(m_cells[row + x], row + x);
             }
-
-            return;
         }
+    }
 
-        const auto range_x = mbr.hx - mbr.lx;
-        const auto range_y = mbr.hy - mbr.ly;
-
-        const auto min_x = clamp((region.lx - mbr.lx) / range_x, 0.0, 1.0) * num_bins;
-        const auto max_x = clamp((region.hx - mbr.lx) / range_x, 0.0, 1.0) * num_bins;
-        const auto min_y = clamp((region.ly - mbr.ly) / range_y, 0.0, 1.0) * num_bins;
-        const auto max_y = clamp((region.hy - mbr.ly) / range_y, 0.0, 1.0) * num_bins;
+    template<typename Region, typename OutIter, typename Filter>
+    void search(Region const& region, OutIter& out, Filter const& filter)
+    {
+        if(m_grids.empty()) { return; }
 
-        if(min_x == max_x || min_y == max_y) { return; }
+        auto const& bounds = get_bounds(region);
 
-        const auto min_x_key = fround(min_x);
-        const auto max_x_key = fround(max_x);
-        const auto min_y_key = fround(min_y);
-        const auto max_y_key = fround(max_y);
+        m_candidates.clear();
+        m_grid_stack.clear();
+        m_grid_stack.push_back(0);
 
-        // TODO: order points in one big array with indexes to the points in bins. Get
-        // indexes to the beginning / end of the x and y and iterate through the big array
-        for(auto x_key = min_x_key; x_key <= max_x_key; ++x_key)
+        while(!m_grid_stack.empty())
         {
-            for(auto y_key = min_y_key; y_key <= max_y_key; ++y_key)
+            const auto g = m_grid_stack.back();
+            m_grid_stack.pop_back();
+
+            auto const& grid = m_grids[g];
+            if(!intersects(grid.bounds, bounds)) { continue; }
+
+            for_each_cell(grid, bounds, [&](Cell const& cell, uint32_t c)
             {
-                const auto key = generate_key(x_key, y_key);
+                if(cell.rank > out.get_max_rank()) { return; }
+                if(!intersects(region, cell.mbr) || !cell.occupancy.intersects(cell.mbr, bounds)) { return; }
+                if(!filter.accept_node(cell)) { return; }
 
-                const auto it = hashgrid.nodes.find(key);
-                if(it != hashgrid.nodes.end())
+                if(cell.child >= 0)
                 {
-                    auto& b = it->second;
-                    if(b.rank > out.get_max_rank()) { break; }
-
-                    search(b, region, out); // TODO: make this iterative
+                    m_grid_stack.push_back(static_cast<uint32_t>(cell.child));
                 }
-            }
+                else
+                {
+                    m_candidates.push_back(c);
+                }
+            });
         }
-    }
 
+        // Min heap on rank, large rects collect many more cells than are scanned before the results fill.
+        const auto higher_rank = [&](uint32_t c1, uint32_t c2) { return m_cells[c1].rank > m_cells[c2].rank; };
+        std::make_heap(m_candidates.begin(), m_candidates.end(), higher_rank);
 
-    inline static
-    int64_t generate_key(int64_t key1, int64_t key2)
-    {
-        return (key2 << 32) | ((key1 & 0xFFFF) << 16) | ((key1 & 0xFFFF) >> 16);
+        while(!m_candidates.empty())
+        {
+            auto const& cell = m_cells[m_candidates.front()];
+            std::pop_heap(m_candidates.begin(), m_candidates.end(), higher_rank);
+            m_candidates.pop_back();
+
+            // Candidates are in rank order, none of the remaining ones can improve the results.
+            if(cell.rank > out.get_max_rank() || !out.can_add(m_points[cell.first])) { break; }
+            if(has_expired(filter)) { break; }
+
+            for(auto i = cell.first; i < cell.last; ++i)
+            {
+                auto const& p = m_points[i];
+                if(p.rank > out.get_max_rank() || !out.can_add(p)) { break; }
+                if(contains(region, p) && filter.accept(p))
+                {
+                    *out = p;
+                }
+            }
+        }
     }
 
 private:
-    static const int num_bins = 100;
-    static const int max_bin_size = 20000;
-    static const int max_height = 1;
+    static const uint32_t target_bin_size = 2048;
+    static const uint32_t max_bin_size = 4 * target_bin_size;
+    static const uint32_t max_bins = 2048;
+    static const int max_height = 4;
 
-    Bin m_hashgrid;
+    std::vector<Point> m_points;    // Grouped by leaf cell, in rank order within a cell.
+    std::vector<Cell> m_cells;
+    std::vector<Grid> m_grids;
 
-    std::size_t m_num_bins;
-    std::size_t m_num_objects;
-    std::size_t m_num_entries;
+    std::vector<uint32_t> m_candidates;
+    std::vector<uint32_t> m_grid_stack;
 };
-
-
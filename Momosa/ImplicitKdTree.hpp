@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <functional>
+#include <assert.h>
+
+#include <ppl.h>
+
+#include "point_utils.hpp"
+#include "query_filters.hpp"
+
+//
+// Kd-tree without pointers over all of the points.  The tree is complete and laid out breadth first, the children of
+// node i are 2i + 1 and 2i + 2, and every leaf is at the same depth.  The points of a node are a contiguous range,
+// halved at each level, so the ranges of the nodes are computed while walking down and the leaves need no offsets.  The
+// points are stored as separate arrays of x, y, rank and id, each leaf in rank order.
+//
+// Each node keeps its mbr, ids and its lowest ranked point.  A query walks the nodes best first by rank, so one tree
+// stops as early as the rank partitions of the other engines do.
+//
+class ImplicitKdTree
+{
+public:
+    static const uint32_t bucket_size = 128;
+
+    ImplicitKdTree() : m_first_leaf(0) {}
+
+    template <typename Iterator>
+    ImplicitKdTree(Iterator points_begin, Iterator points_end)
+        : m_first_leaf(0)
+    {
+        build(points_begin, points_end);
+    }
+
+    template<typename OutIter, typename Filter>
+    void query(Rect const& region, OutIter& out_it, Filter const& filter)
+    {
+        if(m_nodes.empty()) { return; }
+
+        m_queue.clear();
+        push(region, filter, 0, 0, static_cast<uint32_t>(m_xs.size()));
+
+        while(!m_queue.empty())
+        {
+            const auto entry = m_queue.front();
+            auto const& node = m_nodes[entry.node];
+
+            // Nodes are popped in rank order, none of the remaining can improve the results.
+            if(entry.rank > out_it.get_max_rank() || !out_it.can_add(point_at(node.best))) { break; }
+
+            std::pop_heap(m_queue.begin(), m_queue.end(), std::greater<Entry>());
+            m_queue.pop_back();
+
+            if(entry.node >= m_first_leaf)
+            {
+                const bool inside = contains(region, node.mbr);
+                for(auto i = entry.first; i < entry.last; ++i)
+                {
+                    if(!inside && (m_xs[i] < region.lx || m_xs[i] > region.hx || m_ys[i] < region.ly || m_ys[i] > region.hy)) { continue; }
+
+                    const auto p = point_at(i);
+                    if(!out_it.can_add(p)) { break; }
+                    if(filter.accept(p))
+                    {
+                        *out_it = p;
+                    }
+                }
+                continue;
+            }
+
+            const auto middle = split(entry.first, entry.last);
+            push(region, filter, 2 * entry.node + 1, entry.first, middle);
+            push(region, filter, 2 * entry.node + 2, middle, entry.last);
+        }
+    }
+
+    std::size_t size_in_bytes() const
+    {
+        return m_xs.size() * (2 * sizeof(float) + sizeof(int32_t) + sizeof(int8_t)) + m_nodes.size() * sizeof(Node);
+    }
+
+private:
+    struct Node
+    {
+        Rect mbr;
+        uint32_t best;  // Position of the lowest ranked point.
+        id_set ids;
+    };
+
+    struct Entry
+    {
+        int32_t rank;
+        uint32_t node;
+        uint32_t first;
+        uint32_t last;
+    };
+
+    // The left child gets the larger half, so the range of every node follows from its parent's.
+    static uint32_t split(uint32_t first, uint32_t last) { return first + (last - first + 1) / 2; }
+
+    template <typename Iterator>
+    void build(Iterator points_begin, Iterator points_end)
+    {
+        std::vector<Point> points(points_begin, points_end);
+        if(points.empty()) { return; }
+
+        const auto num_points = static_cast<uint32_t>(points.size());
+
+        uint32_t depth = 0;
+        while(((num_points - 1) >> depth) + 1 > bucket_size) { ++depth; }
+
+        m_first_leaf = (1u << depth) - 1;
+        m_nodes.resize(2 * m_first_leaf + 1);
+
+        partition(points, 0, num_points, 0, depth);
+
+        m_xs.resize(num_points);
+        m_ys.resize(num_points);
+        m_ranks.resize(num_points);
+        m_ids.resize(num_points);
+        for(uint32_t i = 0; i < num_points; ++i)
+        {
+            m_xs[i] = points[i].x;
+            m_ys[i] = points[i].y;
+            m_ranks[i] = points[i].rank;
+            m_ids[i] = points[i].id;
+        }
+
+        build_nodes(0, 0, num_points);
+    }
+
+    // Splits the points of a node at its middle along the wider side of their bounds, down to the leaves, which are then
+    // sorted by rank.
+    void partition(std::vector<Point>& points, uint32_t const first, uint32_t const last, uint32_t const level, uint32_t const depth)
+    {
+        if(level == depth)
+        {
+            std::sort(points.begin() + first, points.begin() + last);
+            return;
+        }
+
+        const auto middle = split(first, last);
+        if(first < middle && middle < last)
+        {
+            Rect bounds;
+            initialize(bounds);
+            std::for_each(points.begin() + first, points.begin() + last, [&](Point const& p) { extend_bounds(bounds, p); });
+
+            if(bounds.hx - bounds.lx >= bounds.hy - bounds.ly)
+            {
+                std::nth_element(points.begin() + first, points.begin() + middle, points.begin() + last, [](Point const& p1, Point const& p2) { return p1.x < p2.x; });
+            }
+            else
+            {
+                std::nth_element(points.begin() + first, points.begin() + middle, points.begin() + last, [](Point const& p1, Point const& p2) { return p1.y < p2.y; });
+            }
+        }
+
+        // The subtrees are independent, split the top of the tree across threads.
+        if(level < 8)
+        {
+            concurrency::parallel_invoke(
+                [&] { partition(points, first, middle, level + 1, depth); },
+                [&] { partition(points, middle, last, level + 1, depth); });
+        }
+        else
+        {
+            partition(points, first, middle, level + 1, depth);
+            partition(points, middle, last, level + 1, depth);
+        }
+    }
+
+    void build_nodes(uint32_t const node, uint32_t const first, uint32_t const last)
+    {
+        auto& n = m_nodes[node];
+        initialize(n.mbr);
+        n.best = first;
+
+        if(node >= m_first_leaf)
+        {
+            for(auto i = first; i < last; ++i)
+            {
+                Point p = point_at(i);
+                extend_bounds(n.mbr, p);
+                n.ids.insert(p.id);
+            }
+            return;
+        }
+
+        const auto middle = split(first, last);
+        build_nodes(2 * node + 1, first, middle);
+        build_nodes(2 * node + 2, middle, last);
+
+        auto const& left = m_nodes[2 * node + 1];
+        auto const& right = m_nodes[2 * node + 2];
+
+        n.mbr = left.mbr;
+        extend_bounds(n.mbr, right.mbr);
+        n.ids = left.ids;
+        n.ids.extend(right.ids);
+        n.best = middle < last && m_ranks[right.best] < m_ranks[left.best] ? right.best : left.best;
+    }
+
+    template<typename Filter>
+    void push(Rect const& region, Filter const& filter, uint32_t const node, uint32_t const first, uint32_t const last)
+    {
+        if(first >= last) { return; }
+
+        auto const& n = m_nodes[node];
+        if(!intersects(region, n.mbr) || !filter.accept_node(n)) { return; }
+
+        Entry entry;
+        entry.rank = m_ranks[n.best];
+        entry.node = node;
+        entry.first = first;
+        entry.last = last;
+
+        m_queue.push_back(entry);
+        std::push_heap(m_queue.begin(), m_queue.end(), std::greater<Entry>());
+    }
+
+    Point point_at(uint32_t const i) const
+    {
+        Point p;
+        p.id = m_ids[i];
+        p.rank = m_ranks[i];
+        p.x = m_xs[i];
+        p.y = m_ys[i];
+
+        return p;
+    }
+
+private:
+    std::vector<float> m_xs;
+    std::vector<float> m_ys;
+    std::vector<int32_t> m_ranks;
+    std::vector<int8_t> m_ids;
+
+    std::vector<Node> m_nodes;
+    uint32_t m_first_leaf;
+
+    std::vector<Entry> m_queue; // Min heap on rank of the nodes still to visit.
+};
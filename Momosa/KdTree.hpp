@@ -26,6 +26,9 @@
 #pragma intrinsic(_BitScanReverse)
 
 #include "point_search.h"
+#include "point_utils.hpp"
+#include "query_filters.hpp"
+#include "split_strategy.hpp"
 
 struct KdTask
 {
@@ -93,6 +96,7 @@ public:
     std::vector<KdPoint> fast_bucket; // Note: needs to be indexed the same as bucket
     Rect mbr;
     int32_t rank;
+    id_set ids;
     int32_t parent;
     int32_t left;
     int32_t right;
@@ -107,14 +111,14 @@ public:
 
     KdTree() {} 
 
-    explicit KdTree(const std::vector<Point>::iterator points_begin, const std::vector<Point>::iterator points_end) 
+    explicit KdTree(const std::vector<Point>::iterator points_begin, const std::vector<Point>::iterator points_end, const split_options& split = split_options()) 
     { 
         m_taskstack.reserve(stack_size);
 
-        build(points_begin, points_end); 
+        build(points_begin, points_end, split); 
     }
 
-    void build(const std::vector<Point>::iterator points_begin, const std::vector<Point>::iterator points_end)
+    void build(const std::vector<Point>::iterator points_begin, const std::vector<Point>::iterator points_end, split_options split = split_options())
     {
         std::vector<Point> points(points_begin, points_end);
 
@@ -131,6 +135,14 @@ public:
         m_nodes.reserve(node_count);
         m_nodes.push_back(KdNode());
 
+        Rect bounds;
+        initialize(bounds);
+        for(const auto& p : points)
+        {
+            ::extend_bounds(bounds, p);
+        }
+        split.set_bounds(bounds);
+
         m_taskstack.push_back(KdTask(0, 0, static_cast<int>(num_points), -1, 0, 0));
 
         while(!m_taskstack.empty())
@@ -138,18 +150,20 @@ public:
             auto task = m_taskstack.back();
             m_taskstack.pop_back();
 
-            auto& node = m_nodes[task.node_index];
-            node.parent = task.parent;
+            m_nodes[task.node_index].parent = task.parent;
             
             if(task.last - task.first <= bucket_size)
             {
+                auto& node = m_nodes[task.node_index];
                 auto items = task.last - task.first;
                 assert(items > 0);
 
                 node.bucket.reserve(items);
                 node.fast_bucket.reserve(items);
 
+                // The points are in rank order, keep the bucket in rank order for the early breakout in query.
                 auto it_end = indexer.begin() + task.last;
+                std::sort(indexer.begin() + task.first, it_end);
                 for(auto it = indexer.begin() + task.first; it != it_end; ++it)
                 {
                     node.bucket.push_back(points[*it]);
@@ -160,27 +174,39 @@ public:
             }
             else
             {
-                // todo: use mean instead of median as is described at http://infolab.stanford.edu/~nsample/pubs/samplehaines.pdf
-                // Looks like it will speed up creation, and possibly speed up searching.
-                const auto median = (task.first + task.last) / 2;
-                if(task.dim == 0)
+                auto median = (task.first + task.last) / 2;
+                std::size_t split_dim = task.dim;
+                if(split.strategy == split_strategy::median)
                 {
-                    std::nth_element(indexer.begin() + task.first, indexer.begin() + median, indexer.begin() + task.last, 
-                        [&](int i1, int i2) { return points[i1].x < points[i2].x; });
+                    if(task.dim == 0)
+                    {
+                        std::nth_element(indexer.begin() + task.first, indexer.begin() + median, indexer.begin() + task.last, 
+                            [&](int i1, int i2) { return points[i1].x < points[i2].x; });
+                    }
+                    else
+                    {
+                        std::nth_element(indexer.begin() + task.first, indexer.begin() + median, indexer.begin() + task.last, 
+                            [&](int i1, int i2) { return points[i1].y < points[i2].y; });
+                    }
                 }
                 else
                 {
-                    std::nth_element(indexer.begin() + task.first, indexer.begin() + median, indexer.begin() + task.last, 
-                        [&](int i1, int i2) { return points[i1].y < points[i2].y; });
+                    median = task.first + static_cast<int>(split_elements(indexer.begin() + task.first, indexer.begin() + task.last, split_dim, split, 1, 1, 1,
+                        [&](int i) -> const Point& { return points[i]; }));
                 }
 
-                node.left = static_cast<int>(m_nodes.size());
+                // Uneven splits can make more nodes than reserved, which moves them.
+                const auto left = static_cast<int>(m_nodes.size());
                 m_nodes.push_back(KdNode());
 
-                node.right = static_cast<int>(m_nodes.size());
+                const auto right = static_cast<int>(m_nodes.size());
                 m_nodes.push_back(KdNode());
 
-                auto dim = (task.dim + 1) % 2;
+                auto& node = m_nodes[task.node_index];
+                node.left = left;
+                node.right = right;
+
+                auto dim = static_cast<int>((split_dim + 1) % 2);
                 m_taskstack.push_back(KdTask(node.right, median, task.last, task.node_index, task.depth+1, dim));
                 m_taskstack.push_back(KdTask(node.left, task.first, median, task.node_index, task.depth+1, dim));
             }
@@ -189,6 +215,12 @@ public:
 
     template<typename OutIter>
     void query(const Rect& region, OutIter out_it)
+    {
+        query(region, out_it, no_filter());
+    }
+
+    template<typename OutIter, typename Filter>
+    void query(const Rect& region, OutIter out_it, const Filter& filter)
     {
         if(m_nodes.size() == 0) { return; }
 
@@ -202,6 +234,7 @@ public:
             auto& node = m_nodes[task.node_index];
 
             if(node.rank > out_it.get_max_rank()) { continue; }
+            if(!filter.accept_node(node)) { continue; }
 
             if(intersects(region, node.mbr))
             {
@@ -219,12 +252,16 @@ public:
                         auto& contained_node = m_nodes[task.node_index];
 
                         if(contained_node.rank > out_it.get_max_rank()) { continue; }
+                        if(!filter.accept_node(contained_node)) { continue; }
                         if(contained_node.is_leaf())
                         {
                             for(auto& n : contained_node.bucket)
                             {
                                 if(!out_it.can_add(n)) { break; }
-                                *out_it = n;
+                                if(filter.accept(n))
+                                {
+                                    *out_it = n;
+                                }
                             }
                         }
                         else
@@ -239,8 +276,8 @@ public:
                     int i=0;
                     for(const auto& p : node.fast_bucket)
                     {
-                        if(!out_it.can_add(p)) { break; }
-                        if(within(region, p)) // Hotspot
+                        if(!out_it.can_add(node.bucket[i])) { break; }
+                        if(p.within(region) && filter.accept(node.bucket[i])) // Hotspot
                         {
                             *out_it = node.bucket[i];
                         }
@@ -298,12 +335,13 @@ private:
             if(node.mbr.ly > point.y) node.mbr.ly = point.y;
             if(node.mbr.hy < point.y) node.mbr.hy = point.y;
             if(node.rank > point.rank) node.rank = point.rank;
+            node.ids.insert(point.id);
         }
 
-        extend_bounds(node.parent, node.mbr, node.rank, indexer);
+        extend_bounds(node.parent, node.mbr, node.rank, node.ids, indexer);
     }
 
-    void extend_bounds(int node_index, const Rect& mbr, int32_t rank, std::vector<int>& indexer)
+    void extend_bounds(int node_index, const Rect& mbr, int32_t rank, const id_set& ids, std::vector<int>& indexer)
     {
         auto index = node_index;
         while(index >= 0)
@@ -316,6 +354,7 @@ private:
             if(node.mbr.ly > mbr.ly) node.mbr.ly = mbr.ly;
             if(node.mbr.hy < mbr.hy) node.mbr.hy = mbr.hy;
             if(node.rank > rank) node.rank = rank;
+            node.ids.extend(ids);
 
             index = node.parent;
         }
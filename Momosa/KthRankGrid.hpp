@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <ppl.h>
+
+#include "point_utils.hpp"
+
+//
+// Upper bounds on the rank of the k'th point inside a rect, to start a search with a rank cutoff instead of none.
+//
+// A pyramid of grids over the bounds of the points, level L holding 2^L x 2^L cells.  Each cell keeps the rank of its
+// 1st, 2nd, 4th, ... 2^(max_ks - 1)th lowest ranked point.  A rect fully covering a cell holds at least those points,
+// so the rank of the k'th point of a covered cell, with k rounded up to a power of two, bounds the rank of the k'th
+// point of the rect.  The level is the coarsest whose cells are at most half the sides of the rect, it fully covers a
+// cell of it along each axis.
+//
+class KthRankGrid
+{
+public:
+    // Ranks kept per cell, k up to 2^(max_ks - 1).
+    static const std::size_t max_ks = 11;
+
+    // Finest level, and the least average points per cell of the finest level.
+    static const uint32_t max_level = 8;
+    static const std::size_t min_cell_points = 64;
+
+    // Covered cells examined per query at most along each axis.
+    static const uint32_t max_cells = 8;
+
+    KthRankGrid() : m_levels(0) {}
+
+    // The points must be in rank order.
+    template<typename Iterator>
+    void build(Iterator first, Iterator last, Rect const& bounds)
+    {
+        m_bounds = bounds;
+        m_ranks.clear();
+        m_offsets.clear();
+
+        const auto num_points = static_cast<std::size_t>(std::distance(first, last));
+
+        m_levels = 0;
+        while(m_levels <= max_level && (std::size_t(1) << (2 * m_levels)) * min_cell_points <= num_points) { ++m_levels; }
+        if(m_levels == 0) { return; }
+
+        std::size_t num_cells = 0;
+        for(uint32_t level = 0; level < m_levels; ++level)
+        {
+            m_offsets.push_back(num_cells);
+            num_cells += std::size_t(1) << (2 * level);
+        }
+        m_ranks.assign(num_cells * max_ks, std::numeric_limits<int32_t>::max());
+
+        // In rank order the first 2^j points met in a cell are its 2^j lowest ranked ones.
+        concurrency::parallel_for(uint32_t(0), m_levels, [&](uint32_t level)
+        {
+            const auto cells = uint32_t(1) << level;
+            std::vector<uint32_t> counts(cells * cells, 0);
+
+            for(auto it = first; it != last; ++it)
+            {
+                const auto c = cell_coord(it->y, m_bounds.ly, m_bounds.hy, cells) * cells + cell_coord(it->x, m_bounds.lx, m_bounds.hx, cells);
+                const auto n = ++counts[c];
+                if((n & (n - 1)) != 0) { continue; }
+
+                const auto j = log2(n);
+                if(j < max_ks) { m_ranks[(m_offsets[level] + c) * max_ks + j] = it->rank; }
+            }
+        });
+    }
+
+    // Rank of the count'th point inside region at most, or the largest rank if unknown.
+    int32_t max_rank(Rect const& region, int32_t const count) const
+    {
+        const auto none = std::numeric_limits<int32_t>::max();
+        if(m_levels == 0 || count <= 0) { return none; }
+
+        // k rounded up to a power of two.
+        const auto j = count == 1 ? 0 : log2(static_cast<uint32_t>(count - 1)) + 1;
+        if(j >= max_ks) { return none; }
+
+        const auto level = std::min(m_levels - 1, std::max(cover_level(region.lx, region.hx, m_bounds.lx, m_bounds.hx), cover_level(region.ly, region.hy, m_bounds.ly, m_bounds.hy)));
+        const auto cells = uint32_t(1) << level;
+
+        int32_t x_lo, x_hi, y_lo, y_hi;
+        if(!covered_cells(region.lx, region.hx, m_bounds.lx, m_bounds.hx, cells, x_lo, x_hi)) { return none; }
+        if(!covered_cells(region.ly, region.hy, m_bounds.ly, m_bounds.hy, cells, y_lo, y_hi)) { return none; }
+
+        // Any covered cell gives a bound, large rects only sample some of them.
+        const auto x_step = std::max(1, (x_hi - x_lo + 1) / static_cast<int32_t>(max_cells));
+        const auto y_step = std::max(1, (y_hi - y_lo + 1) / static_cast<int32_t>(max_cells));
+
+        auto result = none;
+        for(auto y = y_lo; y <= y_hi; y += y_step)
+        {
+            for(auto x = x_lo; x <= x_hi; x += x_step)
+            {
+                const auto c = m_offsets[level] + static_cast<std::size_t>(y) * cells + x;
+                result = std::min(result, m_ranks[c * max_ks + j]);
+            }
+        }
+
+        return result;
+    }
+
+    std::size_t size_in_bytes() const { return m_ranks.size() * sizeof(int32_t); }
+
+private:
+    static uint32_t log2(uint32_t n)
+    {
+        uint32_t result = 0;
+        while(n >>= 1) { ++result; }
+
+        return result;
+    }
+
+    static float scale(float const lo, float const hi, uint32_t const cells)
+    {
+        return hi > lo ? cells / (hi - lo) : 0.0f;
+    }
+
+    static uint32_t cell_coord(float const v, float const lo, float const hi, uint32_t const cells)
+    {
+        const auto q = (v - lo) * scale(lo, hi, cells);
+        if(!(q > 0.0f)) { return 0; }
+        if(q >= cells - 1) { return cells - 1; }
+
+        return static_cast<uint32_t>(q);
+    }
+
+    // Coarsest level whose cells are at most half of [lo, hi].
+    uint32_t cover_level(float const lo, float const hi, float const bounds_lo, float const bounds_hi) const
+    {
+        const double side = static_cast<double>(hi) - lo;
+        const double bounds_side = static_cast<double>(bounds_hi) - bounds_lo;
+        if(!(side > 0.0) || !(bounds_side > 0.0)) { return 0; }
+
+        const auto level = std::ceil(std::log2(2.0 * bounds_side / side));
+
+        return level <= 0.0 ? 0 : static_cast<uint32_t>(std::min<double>(level, max_level));
+    }
+
+    //
+    // The cells whose points are all inside [lo, hi].  The points of cell i have floor(q) = i, with q monotone in the
+    // coordinate, so a cell past the one of lo holds only coordinates above lo.  The first and last cells also hold the
+    // points clamped into them and are only covered if [lo, hi] reaches past the bounds.
+    //
+    static bool covered_cells(float const lo, float const hi, float const bounds_lo, float const bounds_hi, uint32_t const cells, int32_t& first, int32_t& last)
+    {
+        const auto s = scale(bounds_lo, bounds_hi, cells);
+        const auto floor_q = [&](float v) { return static_cast<int32_t>(std::floor(std::min<float>((v - bounds_lo) * s, static_cast<float>(cells)))); };
+
+        first = lo <= bounds_lo ? 0 : floor_q(lo) + 1;
+        last = hi >= bounds_hi ? static_cast<int32_t>(cells) - 1 : std::min(static_cast<int32_t>(cells) - 2, floor_q(hi) - 1);
+
+        return first <= last;
+    }
+
+private:
+    Rect m_bounds;
+    uint32_t m_levels;
+    std::vector<std::size_t> m_offsets;     // First cell of each level.
+    std::vector<int32_t> m_ranks;           // max_ks per cell.
+};
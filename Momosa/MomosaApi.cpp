@@ -16,6 +16,8 @@
 
 #include "MomosaApi.hpp"
 #include "SearchContext.hpp"
+#include "TrackSession.hpp"
+#include "SearchCursor.hpp"
 
 
 SearchContext* create(Point const* points_begin, Point const* points_end)
@@ -24,13 +26,174 @@ SearchContext* create(Point const* points_begin, Point const* points_end)
     return context;
 }
 
+static BuildOptions to_options(int32_t const flags)
+{
+    BuildOptions options;
+    options.rank_space = (flags & MOMOSA_BUILD_RANK_SPACE) != 0;
+    options.auto_tune = (flags & MOMOSA_BUILD_AUTO_TUNE) != 0;
+    options.hybrid_partitions = (flags & MOMOSA_BUILD_HYBRID_PARTITIONS) != 0;
+
+    if(flags & MOMOSA_BUILD_GEOMETRIC_PARTITIONS)
+    {
+        options.parameters.first_partition_size = 4096;
+        options.parameters.partition_growth = 4;
+        options.parameters.partition_size = std::numeric_limits<int32_t>::max();
+    }
+
+    switch(flags & MOMOSA_BUILD_SPLIT_MASK)
+    {
+    case MOMOSA_BUILD_SPLIT_MEAN: options.split.strategy = split_strategy::mean; break;
+    case MOMOSA_BUILD_SPLIT_MIDPOINT: options.split.strategy = split_strategy::midpoint; break;
+    case MOMOSA_BUILD_SPLIT_SAH: options.split.strategy = split_strategy::sah; break;
+    case MOMOSA_BUILD_SPLIT_RANK_AWARE: options.split.strategy = split_strategy::rank_aware; break;
+    default: options.split.strategy = split_strategy::median; break;
+    }
+
+    return options;
+}
+
+SearchContext* create_ex(Point const* points_begin, Point const* points_end, int32_t const flags)
+{
+    SearchContext* context = new SearchContext(points_begin, points_end, to_options(flags));
+    return context;
+}
+
+SearchContext* create_tuned(Point const* points_begin, Point const* points_end, Rect const* queries, int32_t const num_queries, int32_t const count, int32_t const flags)
+{
+    auto options = to_options(flags);
+    options.auto_tune = true;
+    options.tune_queries.assign(queries, queries + std::max(0, num_queries));
+    options.tune_count = count;
+
+    SearchContext* context = new SearchContext(points_begin, points_end, options);
+    return context;
+}
+
+SearchContext* create_with_parameters(Point const* points_begin, Point const* points_end, MomosaParameters const* parameters, int32_t const flags)
+{
+    if(parameters->max_elements < 2 || parameters->max_leaf_elements < parameters->max_elements || parameters->partition_size < 1 ||
+       parameters->partition_growth < 1 || parameters->first_partition_size < 0 || parameters->linear_search_threshold < 0)
+    {
+        return nullptr;
+    }
+
+    auto options = to_options(flags);
+    options.auto_tune = false;
+    options.parameters.max_leaf_elements = parameters->max_leaf_elements;
+    options.parameters.max_elements = parameters->max_elements;
+    options.parameters.partition_size = parameters->partition_size;
+    options.parameters.first_partition_size = parameters->first_partition_size;
+    options.parameters.partition_growth = parameters->partition_growth;
+    options.parameters.linear_search_threshold = parameters->linear_search_threshold;
+
+    SearchContext* context = new SearchContext(points_begin, points_end, options);
+    return context;
+}
+
+void get_parameters(SearchContext* sc, MomosaParameters* out_parameters)
+{
+    const auto parameters = sc->parameters();
+    out_parameters->max_leaf_elements = static_cast<int32_t>(parameters.max_leaf_elements);
+    out_parameters->max_elements = static_cast<int32_t>(parameters.max_elements);
+    out_parameters->partition_size = static_cast<int32_t>(parameters.partition_size);
+    out_parameters->first_partition_size = static_cast<int32_t>(parameters.first_partition_size);
+    out_parameters->partition_growth = static_cast<int32_t>(parameters.partition_growth);
+    out_parameters->linear_search_threshold = static_cast<int32_t>(parameters.linear_search_threshold);
+}
+
 int32_t search(SearchContext* sc, Rect const rect, int32_t const count, Point* out_points)
 {
     return sc->search(rect, count, out_points);
 }
 
+int32_t search_rank_range(SearchContext* sc, Rect const rect, int32_t const rank_lo, int32_t const rank_hi, int32_t const count, Point* out_points)
+{
+    return sc->search_rank_range(rect, rank_lo, rank_hi, count, out_points);
+}
+
+int32_t search_filtered(SearchContext* sc, Rect const rect, uint64_t const* id_mask, int32_t const count, Point* out_points)
+{
+    return sc->search_filtered(rect, id_set(id_mask), count, out_points);
+}
+
+int32_t count(SearchContext* sc, Rect const rect)
+{
+    return sc->count(rect);
+}
+
+int32_t search_rects(SearchContext* sc, Rect const* rects, int32_t const num_rects, int32_t const count, Point* out_points)
+{
+    if(num_rects <= 0) { return 0; }
+
+    return sc->search_region(RectUnion(rects, rects + num_rects), count, out_points);
+}
+
+int32_t search_polygon(SearchContext* sc, float const* vertices, int32_t const num_vertices, int32_t const count, Point* out_points)
+{
+    if(num_vertices < 3) { return 0; }
+
+    return sc->search_region(ConvexPolygon(vertices, num_vertices), count, out_points);
+}
+
+int32_t search_batch(SearchContext* sc, Rect const* rects, int32_t const num_rects, int32_t const count, Point* out_points, int32_t* out_counts)
+{
+    return sc->search_batch(rects, num_rects, count, out_points, out_counts);
+}
+
+TrackSession* track_begin(SearchContext* sc)
+{
+    return new TrackSession(*sc);
+}
+
+int32_t track_update(TrackSession* session, Rect const rect, int32_t const count, Point* out_points)
+{
+    return session->update(rect, count, out_points);
+}
+
+TrackSession* track_end(TrackSession* session)
+{
+    delete session;
+    return nullptr;
+}
+
+SearchCursor* search_open(SearchContext* sc, Rect const rect)
+{
+    return new SearchCursor(*sc, rect);
+}
+
+int32_t search_next(SearchCursor* cursor, int32_t const count, Point* out_points)
+{
+    return cursor->next(count, out_points);
+}
+
+SearchCursor* search_close(SearchCursor* cursor)
+{
+    delete cursor;
+    return nullptr;
+}
+
+int32_t search_deadline(SearchContext* sc, Rect const rect, int32_t const count, Point* out_points, int64_t const budget_ns, bool* complete)
+{
+    return sc->search_deadline(rect, count, out_points, budget_ns, complete);
+}
+
+int32_t search_approximate(SearchContext* sc, Rect const rect, int32_t const count, Point* out_points, float const recall, float* estimated_recall)
+{
+    return sc->search_approximate(rect, count, out_points, recall, estimated_recall);
+}
+
 SearchContext* destroy(SearchContext* sc)
 {
     delete sc;
     return nullptr;
+}
+
+int32_t rebuild_async(SearchContext* sc, Point const* points_begin, Point const* points_end)
+{
+    return sc->rebuild_async(points_begin, points_end) ? 1 : 0;
+}
+
+int32_t rebuild_wait(SearchContext* sc)
+{
+    return sc->rebuild_wait() ? 1 : 0;
 }
\ No newline at end of file
@@ -24,9 +24,132 @@
 
 #include "point_search.h"
 
+/* Declaration of the struct that follows a viewport across consecutive searches. */
+class TrackSession;
+
+/* Declaration of the struct that pages through the results of a search. */
+class SearchCursor;
+
+/* Flags for create_ex. Index the rank of each coordinate among the points instead of the coordinate. Needs 8 more
+bytes per point, ignored above 2^24 points. */
+#define MOMOSA_BUILD_RANK_SPACE 0x1
+
+/* How the trees split their nodes when bulk loading, one of the following in the MOMOSA_BUILD_SPLIT_MASK bits of the
+flags. The default is the count based median. See split_strategy.hpp. */
+#define MOMOSA_BUILD_SPLIT_MEDIAN 0x000
+#define MOMOSA_BUILD_SPLIT_MEAN 0x100
+#define MOMOSA_BUILD_SPLIT_MIDPOINT 0x200
+#define MOMOSA_BUILD_SPLIT_SAH 0x300
+#define MOMOSA_BUILD_SPLIT_RANK_AWARE 0x400
+#define MOMOSA_BUILD_SPLIT_MASK 0xf00
+
+/* Flag for create_ex. Choose the parameters below by timing candidates built on a sample of the points with a synthetic
+query mix, for the cache sizes of the machine. Adds a few seconds to the build, and to each rebuild. */
+#define MOMOSA_BUILD_AUTO_TUNE 0x2
+
+/* Flag for create_ex. Cut the points into rank partitions of 4096 points growing by 4 times each, instead of equal
+partitions of 200000. The top points of a dense rect are found in the first small partitions, and a sparse rect
+searches a handful of partitions instead of one per 200000 points. */
+#define MOMOSA_BUILD_GEOMETRIC_PARTITIONS 0x4
+
+/* Flag for create_ex. Let each rank partition choose its engine. Partitions of up to 2048 points are tried as a scan in
+rank order and the ones most queries reach as a dense grid, each kept if the query mix of MOMOSA_BUILD_AUTO_TUNE runs
+faster. The others stay R-trees. */
+#define MOMOSA_BUILD_HYBRID_PARTITIONS 0x8
+
+/* Parameters of the index. The defaults were tuned for 10 million uniformly distributed points. */
+struct MomosaParameters
+{
+    int32_t max_leaf_elements;          /* Points per tree leaf, 80 by default. */
+    int32_t max_elements;               /* Children per tree node, 40 by default. */
+    int32_t partition_size;             /* Points per rank partition, 200000 by default. */
+    int32_t first_partition_size;       /* Geometric partitions start at this size and grow up to partition_size, 0 by
+                                           default for equal partitions. */
+    int32_t partition_growth;           /* Size of each geometric partition over the previous one, 4 by default. */
+    int32_t linear_search_threshold;    /* Rects expected to hold fewer points in a slab are scanned, 1000 by default. */
+};
+
 extern "C" 
 {
     MOMOSA_DLL_API SearchContext* create(const Point* points_begin, const Point* points_end);
+
+    /* Same as create, with a combination of the MOMOSA_BUILD flags. Rebuilds use the same flags. */
+    MOMOSA_DLL_API SearchContext* create_ex(const Point* points_begin, const Point* points_end, const int32_t flags);
+
+    /* Same as create_ex with MOMOSA_BUILD_AUTO_TUNE, but the parameters are timed on the "num_queries" recorded
+    "queries" for the top "count" points each. */
+    MOMOSA_DLL_API SearchContext* create_tuned(const Point* points_begin, const Point* points_end, const Rect* queries, const int32_t num_queries, const int32_t count, const int32_t flags);
+
+    /* Same as create_ex, but built with "parameters", such as ones chosen by an earlier auto tuned build. Return nullptr if
+    max_elements is below 2, max_leaf_elements below max_elements, partition_size or partition_growth below 1, or
+    first_partition_size or linear_search_threshold negative. */
+    MOMOSA_DLL_API SearchContext* create_with_parameters(const Point* points_begin, const Point* points_end, const MomosaParameters* parameters, const int32_t flags);
+
+    /* Copy the parameters the current index of "sc" was built with to "out_parameters". */
+    MOMOSA_DLL_API void get_parameters(SearchContext* sc, MomosaParameters* out_parameters);
+
     MOMOSA_DLL_API int32_t search(SearchContext* sc, const Rect rect, const int32_t count, Point* out_points);
+
+    /* Same as search, but only points with a rank in [rank_lo, rank_hi) are considered. */
+    MOMOSA_DLL_API int32_t search_rank_range(SearchContext* sc, const Rect rect, const int32_t rank_lo, const int32_t rank_hi, const int32_t count, Point* out_points);
+
+    /* Same as search, but only points whose id is in "id_mask" are considered. "id_mask" points to 4 words holding one
+    bit per id, where id (uint8_t)id is bit (id & 63) of word (id >> 6). */
+    MOMOSA_DLL_API int32_t search_filtered(SearchContext* sc, const Rect rect, const uint64_t* id_mask, const int32_t count, Point* out_points);
+
+    /* Return the exact number of points inside "rect". */
+    MOMOSA_DLL_API int32_t count(SearchContext* sc, const Rect rect);
+
+    /* Same as search, but the region is the union of "num_rects" rects. Points inside several of the rects are only
+    reported once. */
+    MOMOSA_DLL_API int32_t search_rects(SearchContext* sc, const Rect* rects, const int32_t num_rects, const int32_t count, Point* out_points);
+
+    /* Same as search, but the region is a convex polygon given as "num_vertices" x,y pairs in either winding order.
+    Points on the edges are inside. */
+    MOMOSA_DLL_API int32_t search_polygon(SearchContext* sc, const float* vertices, const int32_t num_vertices, const int32_t count, Point* out_points);
+
+    /* Same as search for each of "num_rects" rects. The results of rect i are copied to out_points + i * count and their
+    number to out_counts[i], "out_points" holds num_rects * count points. The searches are interleaved to overlap their
+    cache misses. That only pays off for rects holding few points in an index much larger than the cache, larger rects
+    can be slower than searching the rects one at a time. Return the number of points found over all of the rects. */
+    MOMOSA_DLL_API int32_t search_batch(SearchContext* sc, const Rect* rects, const int32_t num_rects, const int32_t count, Point* out_points, int32_t* out_counts);
+
+    /* Start following a panning and zooming viewport. The session must be ended before "sc" is destroyed. */
+    MOMOSA_DLL_API TrackSession* track_begin(SearchContext* sc);
+
+    /* Same as search for the next rect of the viewport. Only the area that entered the viewport since the previous
+    update is searched. */
+    MOMOSA_DLL_API int32_t track_update(TrackSession* session, const Rect rect, const int32_t count, Point* out_points);
+
+    /* Release the session. Return nullptr if successful, "session" otherwise. */
+    MOMOSA_DLL_API TrackSession* track_end(TrackSession* session);
+
+    /* Start paging through the points inside "rect" in rank order. The cursor keeps the data it was opened on, the
+    index it replaced in a rebuild is released when the last of its cursors is closed. */
+    MOMOSA_DLL_API SearchCursor* search_open(SearchContext* sc, const Rect rect);
+
+    /* Copy the next "count" points of the cursor to "out_points". Return the number of points copied, 0 once all of
+    the points have been reported. */
+    MOMOSA_DLL_API int32_t search_next(SearchCursor* cursor, const int32_t count, Point* out_points);
+
+    /* Release the cursor. Return nullptr if successful, "cursor" otherwise. */
+    MOMOSA_DLL_API SearchCursor* search_close(SearchCursor* cursor);
+
+    /* Search like "search" but give up after about "budget_ns" nanoseconds and return the best points found so far.
+    "complete" is set to false if the search was cut short, in which case the points may not be the top "count". */
+    MOMOSA_DLL_API int32_t search_deadline(SearchContext* sc, const Rect rect, const int32_t count, Point* out_points, const int64_t budget_ns, bool* complete);
+
+    /* Approximate search for previews. Stops searching once the expected fraction of the top "count" points found
+    reaches "recall", in (0, 1]. The estimated fraction actually found is stored in "estimated_recall". */
+    MOMOSA_DLL_API int32_t search_approximate(SearchContext* sc, const Rect rect, const int32_t count, Point* out_points, const float recall, float* estimated_recall);
+
     MOMOSA_DLL_API SearchContext* destroy(SearchContext* sc);
+
+    /* Rebuild the context from a new set of points on a background thread. Searches keep using the current data until
+    the new index is published. Return 1 if the rebuild was started, 0 if one is already in progress. */
+    MOMOSA_DLL_API int32_t rebuild_async(SearchContext* sc, const Point* points_begin, const Point* points_end);
+
+    /* Block until a pending rebuild has been published. Return 1 if a rebuild was waited on, 0 otherwise. May be called
+    from another thread than rebuild_async. */
+    MOMOSA_DLL_API int32_t rebuild_wait(SearchContext* sc);
 }
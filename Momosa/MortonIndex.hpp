@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <assert.h>
+
+#include "point_utils.hpp"
+
+//
+// Points sorted along a Z-order curve over 16 bit quantized coordinates and cut into small blocks, each with its mbr and
+// lowest rank.  Everything is in two flat arrays, building is a sort.
+//
+// A query walks the blocks overlapping the curve range of the rect, jumping over the parts of the curve outside of it
+// with BIGMIN (Tropf and Herzog), then scans the blocks whose mbr intersects the rect lowest rank first.
+//
+class MortonIndex
+{
+public:
+    // 208 bytes of points, a few cache lines.  Blocks of a single line hold 4 points and were slower, each block costs
+    // an mbr test and a 28 byte entry.
+    static const std::size_t block_size = 16;
+
+    MortonIndex() {}
+
+    // The quantization is over bounds, which should hold every point of the index.
+    template <typename Iterator>
+    MortonIndex(Iterator points_begin, Iterator points_end, Rect const& bounds)
+    {
+        build(points_begin, points_end, bounds);
+    }
+
+    template<typename OutIter>
+    void query(Rect const& region, OutIter& out_it)
+    {
+        if(m_blocks.empty()) { return; }
+        if(!intersects(region, m_bounds)) { return; }
+
+        const auto code_lo = encode(quantize<0>(region.lx), quantize<1>(region.ly));
+        const auto code_hi = encode(quantize<0>(region.hx), quantize<1>(region.hy));
+
+        m_candidates.clear();
+
+        auto it = std::lower_bound(m_blocks.begin(), m_blocks.end(), code_lo, [](Block const& b, uint32_t code) { return b.last_code < code; });
+        while(it != m_blocks.end() && it->first_code <= code_hi)
+        {
+            if(intersects(region, it->mbr) && it->rank <= out_it.get_max_rank())
+            {
+                m_candidates.push_back(static_cast<uint32_t>(it - m_blocks.begin()));
+            }
+
+            // Points with the same code can be cut into several blocks, the next one starts on the code this one ends on.
+            const auto next = it + 1;
+            if(next != m_blocks.end() && next->first_code <= it->last_code)
+            {
+                it = next;
+                continue;
+            }
+
+            if(it->last_code >= code_hi) { break; }
+
+            // Skip to the block holding the next code inside the rect.
+            auto code = it->last_code + 1;
+            if(!in_box(code, code_lo, code_hi))
+            {
+                code = bigmin(code, code_lo, code_hi);
+            }
+
+            it = std::lower_bound(next, m_blocks.end(), code, [](Block const& b, uint32_t code) { return b.last_code < code; });
+        }
+
+        std::sort(m_candidates.begin(), m_candidates.end(), [&](uint32_t b1, uint32_t b2) { return m_blocks[b1].rank < m_blocks[b2].rank; });
+
+        for(auto b : m_candidates)
+        {
+            auto const& block = m_blocks[b];
+
+            // Candidates are in rank order, none of the remaining ones can improve the results.
+            if(block.rank > out_it.get_max_rank()) { break; }
+
+            // The points of a block are in rank order too.
+            const auto last = m_points.begin() + std::min(static_cast<std::size_t>(b + 1) * block_size, m_points.size());
+            for(auto p = m_points.begin() + static_cast<std::size_t>(b) * block_size; p != last; ++p)
+            {
+                if(!out_it.can_add(*p)) { break; }
+                if(contains(region, *p))
+                {
+                    *out_it = *p;
+                }
+            }
+        }
+    }
+
+    int32_t get_min_rank() const { return m_min_rank; }
+
+private:
+    struct Block
+    {
+        uint32_t first_code;
+        uint32_t last_code;
+        int32_t rank;
+        Rect mbr;
+    };
+
+    template <typename Iterator>
+    void build(Iterator points_begin, Iterator points_end, Rect const& bounds)
+    {
+        m_bounds = bounds;
+        m_scale[0] = bounds.hx > bounds.lx ? 65535.0f / (bounds.hx - bounds.lx) : 0.0f;
+        m_scale[1] = bounds.hy > bounds.ly ? 65535.0f / (bounds.hy - bounds.ly) : 0.0f;
+
+        std::vector<std::pair<uint32_t, Point>> coded;
+        coded.reserve(std::distance(points_begin, points_end));
+        for(auto it = points_begin; it != points_end; ++it)
+        {
+            coded.push_back(std::make_pair(encode(quantize<0>(it->x), quantize<1>(it->y)), *it));
+        }
+
+        std::sort(coded.begin(), coded.end(), [](std::pair<uint32_t, Point> const& p1, std::pair<uint32_t, Point> const& p2) { return p1.first < p2.first; });
+
+        m_min_rank = std::numeric_limits<int32_t>::max();
+        m_points.reserve(coded.size());
+        m_blocks.reserve(coded.size() / block_size + 1);
+
+        for(std::size_t first = 0; first < coded.size(); first += block_size)
+        {
+            const auto last = std::min(first + block_size, coded.size());
+
+            Block block;
+            block.first_code = coded[first].first;
+            block.last_code = coded[last - 1].first;
+            block.rank = std::numeric_limits<int32_t>::max();
+            initialize(block.mbr);
+
+            for(auto i = first; i < last; ++i)
+            {
+                auto const& p = coded[i].second;
+                extend_bounds(block.mbr, p);
+                block.rank = std::min(block.rank, p.rank);
+
+                m_points.push_back(p);
+            }
+
+            std::sort(m_points.begin() + first, m_points.end());
+
+            m_min_rank = std::min(m_min_rank, block.rank);
+            m_blocks.push_back(block);
+        }
+    }
+
+    template<std::size_t I>
+    uint32_t quantize(float v) const
+    {
+        const auto q = (v - get_dim_coord_lo<I>(m_bounds)) * m_scale[I];
+        if(!(q > 0.0f)) { return 0; }
+        if(q >= 65535.0f) { return 65535; }
+
+        return static_cast<uint32_t>(q);
+    }
+
+    // Interleaves the bits of x and y, x in the even bits.
+    static uint32_t encode(uint32_t x, uint32_t y)
+    {
+        return spread(x) | (spread(y) << 1);
+    }
+
+    static uint32_t spread(uint32_t v)
+    {
+        v = (v | (v << 8)) & 0x00FF00FFu;
+        v = (v | (v << 4)) & 0x0F0F0F0Fu;
+        v = (v | (v << 2)) & 0x33333333u;
+        v = (v | (v << 1)) & 0x55555555u;
+
+        return v;
+    }
+
+    static bool in_box(uint32_t code, uint32_t code_lo, uint32_t code_hi)
+    {
+        static const uint32_t x_mask = 0x55555555u;
+        static const uint32_t y_mask = 0xAAAAAAAAu;
+
+        return (code & x_mask) >= (code_lo & x_mask) && (code & x_mask) <= (code_hi & x_mask)
+            && (code & y_mask) >= (code_lo & y_mask) && (code & y_mask) <= (code_hi & y_mask);
+    }
+
+    // Smallest code greater than code inside the box spanned by code_lo and code_hi.
+    static uint32_t bigmin(uint32_t code, uint32_t code_lo, uint32_t code_hi)
+    {
+        uint32_t result = 0;
+
+        for(int bit = 31; bit >= 0; --bit)
+        {
+            const auto mask = uint32_t(1) << bit;
+            const auto lower = (bit & 1 ? 0xAAAAAAAAu : 0x55555555u) & (mask - 1);  // Lower bits of the same dimension.
+
+            const bool v = (code & mask) != 0;
+            const bool lo = (code_lo & mask) != 0;
+            const bool hi = (code_hi & mask) != 0;
+
+            if(!v && !lo && hi)
+            {
+                result = (code_lo | mask) & ~lower;
+                code_hi = (code_hi & ~mask) | lower;
+            }
+            else if(!v && lo && hi)
+            {
+                return code_lo;
+            }
+            else if(v && !lo && !hi)
+            {
+                return result;
+            }
+            else if(v && !lo && hi)
+            {
+                code_lo = (code_lo | mask) & ~lower;
+            }
+        }
+
+        return result;
+    }
+
+private:
+    std::vector<Point> m_points;    // Blocks of block_size points.
+    std::vector<Block> m_blocks;
+    std::vector<uint32_t> m_candidates;
+    Rect m_bounds;
+    float m_scale[2];
+    int32_t m_min_rank;
+};
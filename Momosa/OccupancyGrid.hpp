@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "point_utils.hpp"
+
+//
+// Which of the 8x8 sub-cells of an mbr hold points, one bit each.  A rect that intersects an mbr but only its empty
+// sub-cells holds none of its points, so nodes and cells can be skipped where the mbr alone cannot, thin rects through
+// the dead space of a node in particular.
+//
+// The mbr is not kept, it is passed to every call and must be the same the points were added with.  Coordinates map to
+// sub-cells with the same float expression on both sides, so the mapping is monotone and a point inside a rect always
+// falls in one of the sub-cells the rect is tested against.
+//
+class OccupancyGrid
+{
+public:
+    static const uint32_t bins = 8;
+
+    OccupancyGrid() : m_bits(0) {}
+
+    template<typename Value>
+    void add(Rect const& mbr, Value const& p)
+    {
+        const auto x = sub_cell(p.x, mbr.lx, mbr.hx);
+        const auto y = sub_cell(p.y, mbr.ly, mbr.hy);
+
+        m_bits |= uint64_t(1) << (y * bins + x);
+    }
+
+    // False if no point of the mbr is inside region.
+    bool intersects(Rect const& mbr, Rect const& region) const
+    {
+        const auto x_lo = sub_cell(region.lx, mbr.lx, mbr.hx);
+        const auto x_hi = sub_cell(region.hx, mbr.lx, mbr.hx);
+        const auto y_lo = sub_cell(region.ly, mbr.ly, mbr.hy);
+        const auto y_hi = sub_cell(region.hy, mbr.ly, mbr.hy);
+
+        // Bits x_lo to x_hi of a row, repeated in rows y_lo to y_hi.
+        const uint64_t row = (0xffu >> (bins - 1 - x_hi)) & (0xffu << x_lo);
+        const uint64_t rows = (~uint64_t(0) >> (bins * (bins - 1 - y_hi))) & (~uint64_t(0) << (bins * y_lo));
+
+        return (m_bits & (row * (rows & 0x0101010101010101ull))) != 0;
+    }
+
+    // Number of sub-cells holding points.
+    uint32_t count() const
+    {
+        uint32_t result = 0;
+        for(auto bits = m_bits; bits != 0; bits &= bits - 1) { ++result; }
+
+        return result;
+    }
+
+private:
+    static uint32_t sub_cell(float const v, float const lo, float const hi)
+    {
+        const auto scale = hi > lo ? bins / (hi - lo) : 0.0f;
+        const auto q = (v - lo) * scale;
+        if(!(q > 0.0f)) { return 0; }
+        if(q >= bins - 1) { return bins - 1; }
+
+        return static_cast<uint32_t>(q);
+    }
+
+private:
+    uint64_t m_bits;
+};
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "HashGridSpatialIndex.hpp"
+#include "iterators.hpp"
+#include "point_utils.hpp"
+#include "query_filters.hpp"
+#include "regions.hpp"
+#include "split_strategy.hpp"
+
+//
+// One rank partition of the points and the engine that searches it.  Partitions differ, the first ones hold the most
+// important points and are reached by nearly every query while the later ones rarely are, so each can be an R-tree, a
+// dense grid or a flat list scanned in rank order.  The engines take the same reporters and filters, a search shares
+// one reporter over all of the partitions whatever their engines.
+//
+enum class partition_engine { rtree, grid, flat };
+
+template<typename Tree>
+class Partition
+{
+public:
+    // Partitions of up to this many points may be scanned, a tree can cost more than it saves.
+    static const std::size_t max_flat_size = 2048;
+
+    // The points may be in any order, an R-tree reorders them.
+    template<typename Iterator, typename Parameters>
+    Partition(partition_engine engine, Iterator first, Iterator last, Parameters const& parameters, split_options const& split)
+        : m_engine(engine)
+        , m_size(static_cast<std::size_t>(std::distance(first, last)))
+        , m_min_rank(first != last ? std::min_element(first, last)->rank : std::numeric_limits<int32_t>::max())
+    {
+        switch(engine)
+        {
+        case partition_engine::rtree:
+            m_tree = std::make_shared<Tree>(first, last, parameters, split);
+            break;
+
+        case partition_engine::grid:
+            {
+                Rect mbr;
+                initialize(mbr);
+                std::for_each(first, last, [&](Point const& p) { extend_bounds(mbr, p); });
+
+                m_grid = std::make_shared<HashGridSpatialIndex>(first, last, mbr);
+            }
+            break;
+
+        case partition_engine::flat:
+            m_points.assign(first, last);
+            std::sort(m_points.begin(), m_points.end());
+            break;
+        }
+    }
+
+    partition_engine engine() const { return m_engine; }
+    std::size_t size() const { return m_size; }
+    int32_t get_min_rank() const { return m_min_rank; }
+
+    // The R-tree of the partition, null for the other engines.
+    Tree* tree() const { return m_tree.get(); }
+
+    template<typename Region, typename OutIter, typename Filter>
+    void query(Region const& region, OutIter& out, Filter const& filter)
+    {
+        switch(m_engine)
+        {
+        case partition_engine::rtree: m_tree->query(region, out, filter); break;
+        case partition_engine::grid: m_grid->query(region, out, filter); break;
+        case partition_engine::flat: query_flat(region, out, filter); break;
+        }
+    }
+
+    std::size_t count(Rect const& region)
+    {
+        switch(m_engine)
+        {
+        case partition_engine::rtree: return m_tree->count(region);
+        case partition_engine::grid: return m_grid->count(region);
+        default: return std::count_if(m_points.begin(), m_points.end(), [&](Point const& p) { return contains(region, p); });
+        }
+    }
+
+    // Adds an R-tree to the cursor.  Returns false for the other engines, the caller pages their points with query() and
+    // a rank_range_filter instead.
+    template<typename Cursor>
+    bool open(Cursor& cursor)
+    {
+        if(m_engine != partition_engine::rtree) { return false; }
+
+        cursor.add(*m_tree);
+        return true;
+    }
+
+private:
+    template<typename Region, typename OutIter, typename Filter>
+    void query_flat(Region const& region, OutIter& out, Filter const& filter)
+    {
+        if(has_expired(filter)) { return; }
+
+        for(auto const& p : m_points)
+        {
+            if(p.rank > out.get_max_rank() || !out.can_add(p)) { break; }
+
+            if(contains(region, p) && filter.accept(p))
+            {
+                *out = p;
+            }
+        }
+    }
+
+private:
+    partition_engine m_engine;
+    std::size_t m_size;
+    int32_t m_min_rank;
+
+    std::shared_ptr<Tree> m_tree;
+    std::shared_ptr<HashGridSpatialIndex> m_grid;
+    std::vector<Point> m_points;    // Flat partitions, in rank order.
+};
@@ -18,10 +18,17 @@
 
 #include <algorithm>
 #include <vector>
+#include <queue>
+#include <functional>
 #include <assert.h>
+#include <xmmintrin.h>
 
+#include "OccupancyGrid.hpp"
 #include "TaskStack.hpp"
 #include "point_utils.hpp"
+#include "query_filters.hpp"
+#include "regions.hpp"
+#include "split_strategy.hpp"
 
 template <std::size_t MaxElements>
 struct default_min_elements
@@ -42,45 +49,387 @@ struct rtree_parameters
     static std::size_t get_min_elements() { return MinElements; }
 };
 
+// Same as rtree_parameters, chosen at run time.
+struct rtree_dynamic_parameters
+{
+    rtree_dynamic_parameters(std::size_t max_leaf_elements_, std::size_t max_elements_)
+        : max_leaf_elements(max_leaf_elements_)
+        , max_elements(max_elements_)
+        , min_elements(std::max<std::size_t>(1, (max_elements_ * 3) / 10))
+    {
+    }
+
+    std::size_t get_max_leaf_elements() const { return max_leaf_elements; }
+    std::size_t get_max_elements() const { return max_elements; }
+    std::size_t get_min_elements() const { return min_elements; }
+
+    std::size_t max_leaf_elements;
+    std::size_t max_elements;
+    std::size_t min_elements;
+};
+
 template <typename Value, typename Parameters>
 class RTree
 {
 public:
     template <typename Iterator>
-    explicit RTree(Iterator points_begin, Iterator points_end, Parameters const& parameters = Parameters()) 
+    explicit RTree(Iterator points_begin, Iterator points_end, Parameters const& parameters = Parameters(), split_options const& split = split_options()) 
         : m_parameters(parameters), m_values_count(0), m_height(0)
     { 
-        build(points_begin, points_end); 
+        build(points_begin, points_end, split); 
     }
 
-    template<typename OutIter>
-    void query(Rect const& region, OutIter& out_it)
+    template<typename Region, typename OutIter>
+    void query(Region const& region, OutIter& out_it)
+    {
+        query(region, out_it, no_filter());
+    }
+
+    template<typename Region, typename OutIter, typename Filter>
+    void query(Region const& region, OutIter& out_it, Filter const& filter)
     {
         if(m_values_count == 0) { return; }
 
         if(!intersects(region, m_root.mbr)) { return; }
+        if(!filter.accept_node(m_root)) { return; }
 
-        query_iterative(region, out_it);
+        // Trees with no more than max_leaf_elements values are built as a single leaf.
+        if(m_root.is_leaf())
+        {
+            query_leaf(m_root, region, out_it, filter);
+            return;
+        }
+
+        query_iterative(region, out_it, filter);
     }
 
+    // Number of values inside the region.  Nodes contained by the region add their count without being visited.
+    std::size_t count(Rect const& region)
+    {
+        if(m_values_count == 0) { return 0; }
+
+        if(!intersects(region, m_root.mbr)) { return 0; }
+        if(contains(region, m_root.mbr)) { return m_values_count; }
+        if(m_root.is_leaf()) { return count_leaf(m_root, region); }
+
+        std::size_t result = 0;
+
+        nodesToSearch.push_back(&m_root);
+
+        while(!nodesToSearch.empty())
+        {
+            auto& subtree = *nodesToSearch.back();
+            nodesToSearch.pop_back();
+
+            for(auto& node : subtree.nodes)
+            {
+                const auto& mbr = node.mbr;
+                if(intersects(region, mbr))
+                {
+                    if(contains(region, mbr))
+                    {
+                        result += node.count;
+                    }
+                    else if(!node.occupied(region))
+                    {
+                        continue;
+                    }
+                    else if(node.is_leaf())
+                    {
+                        result += count_leaf(node, region);
+                    }
+                    else
+                    {
+                        nodesToSearch.push_back(&node);
+                    }
+                }
+            }
+        }
+
+        return result;
+    }
+
+    int32_t get_min_rank() const { return m_root.rank; }
+    int32_t get_max_rank() const { return m_root.max_rank; }
+
+    std::size_t size() const { return m_values_count; }
+
 private:
     struct Node
     {
         Node() 
             : rank(std::numeric_limits<int32_t>::max())
+            , max_rank(std::numeric_limits<int32_t>::lowest())
+            , count(0)
         {
             initialize(mbr);
         }
 
         bool is_leaf() const { return !leaf.empty(); }
 
+        // False if none of the values of the node is inside region.
+        bool occupied(Rect const& region) const { return occupancy.intersects(mbr, region); }
+
         int32_t rank;
+        int32_t max_rank;
+        uint32_t count;
         Rect mbr;
+        OccupancyGrid occupancy;
+        id_set ids;
 
         std::vector<Node> nodes;
         std::vector<Value> leaf;
     };
 
+public:
+    // Best-first traversal that reports the values inside a region in rank order, a page at a time.  The frontier of
+    // nodes and leaf positions is kept between calls ordered by the smallest rank each can still produce, so a page
+    // only costs as much as the values it reports.  The trees added must outlive the cursor.
+    template<typename Region>
+    class Cursor
+    {
+    public:
+        explicit Cursor(Region const& region) 
+            : m_region(region) 
+        {
+        }
+
+        void add(RTree const& tree)
+        {
+            if(tree.m_values_count == 0) { return; }
+            if(!intersects(m_region, tree.m_root.mbr)) { return; }
+
+            push(tree.m_root, contains(m_region, tree.m_root.mbr));
+        }
+
+        template<typename OutIter>
+        std::size_t next(std::size_t count, OutIter out_it)
+        {
+            std::size_t reported = 0;
+
+            while(reported < count && settle())
+            {
+                const auto entry = m_frontier.top();
+                m_frontier.pop();
+
+                auto& node = *entry.node;
+                *out_it = node.leaf[entry.index];
+                ++out_it;
+                ++reported;
+
+                push_leaf(node, entry.index + 1, entry.contained);
+            }
+
+            return reported;
+        }
+
+        // The rank of the value next() reports next.  Returns false if there is none.
+        bool peek_rank(int32_t& rank)
+        {
+            if(!settle()) { return false; }
+
+            rank = m_frontier.top().rank;
+            return true;
+        }
+
+        bool empty() const { return m_frontier.empty(); }
+
+    private:
+        // Expands the nodes at the top of the frontier until a value is at the top.  Returns false if none is left.
+        bool settle()
+        {
+            while(!m_frontier.empty() && !m_frontier.top().node->is_leaf())
+            {
+                const auto entry = m_frontier.top();
+                m_frontier.pop();
+
+                for(auto& n : entry.node->nodes)
+                {
+                    if(entry.contained)
+                    {
+                        push(n, true);
+                    }
+                    else if(intersects(m_region, n.mbr) && n.occupied(get_bounds(m_region)))
+                    {
+                        push(n, contains(m_region, n.mbr));
+                    }
+                }
+            }
+
+            return !m_frontier.empty();
+        }
+
+        // Either a node that has not been expanded yet or the position of the next value inside the region in a leaf.
+        struct Entry
+        {
+            int32_t rank;
+            uint32_t index;
+            bool contained;
+            Node const* node;
+        };
+
+        void push(Node const& node, bool contained)
+        {
+            if(node.is_leaf())
+            {
+                push_leaf(node, 0, contained);
+                return;
+            }
+
+            Entry e = { node.rank, 0, contained, &node };
+            m_frontier.push(e);
+        }
+
+        void push_leaf(Node const& node, uint32_t index, bool contained)
+        {
+            auto& leaf = node.leaf;
+            const auto size = static_cast<uint32_t>(leaf.size());
+
+            if(!contained)
+            {
+                while(index < size && !contains(m_region, leaf[index])) { ++index; }
+            }
+
+            if(index < size)
+            {
+                Entry e = { leaf[index].rank, index, contained, &node };
+                m_frontier.push(e);
+            }
+        }
+
+        Region m_region;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> m_frontier;
+    };
+
+    //
+    // Depth-first search of one region that runs a node at a time, to interleave the searches of a batch.  A step
+    // ends by prefetching the node the next one searches, and the caller runs steps of the other searches in between,
+    // so their cache misses overlap instead of stalling each search in turn.  The tree and the region must outlive the
+    // traversal.
+    //
+    template<typename Region>
+    class Traversal
+    {
+    public:
+        // Cache lines prefetched from the start of the children or values of a node, about a whole leaf.
+        static const std::size_t prefetch_lines = 16;
+
+        Traversal() : m_region(nullptr) {}
+
+        // Starts over on tree.  Returns false if there is nothing to search.
+        template<typename Filter>
+        bool start(RTree& tree, Region const& region, Filter const& filter)
+        {
+            m_region = &region;
+            m_stack.clear();
+
+            auto& root = tree.m_root;
+            if(tree.m_values_count == 0 || !intersects(region, root.mbr) || !filter.accept_node(root)) { return false; }
+
+            push(root, contains(region, root.mbr));
+            prefetch_next();
+
+            return true;
+        }
+
+        // Searches the node on top of the stack.  Returns false once the search is done.
+        template<typename OutIter, typename Filter>
+        bool step(OutIter& out_it, Filter const& filter)
+        {
+            if(m_stack.empty()) { return false; }
+
+            const auto entry = m_stack.back();
+            m_stack.pop_back();
+
+            // The results may have improved since the node was pushed.
+            auto& node = *entry.node;
+            if(node.rank > out_it.get_max_rank()) { return prefetch_next(); }
+
+            if(node.is_leaf())
+            {
+                if(entry.contained) { report_leaf(node, out_it, filter); } else { query_leaf(node, *m_region, out_it, filter); }
+
+                return prefetch_next();
+            }
+
+            auto const& bounds = get_bounds(*m_region);
+            const auto pushed = m_stack.size();
+            for(auto& n : node.nodes)
+            {
+                if(n.rank > out_it.get_max_rank()) { break; }
+                if(!filter.accept_node(n)) { continue; }
+
+                if(entry.contained || contains(*m_region, n.mbr))
+                {
+                    // Reported on the spot like query_iterative() does, the cutoff drops before the next children.
+                    if(n.is_leaf()) { report_leaf(n, out_it, filter); } else { push(n, true); }
+                }
+                else if(intersects(*m_region, n.mbr) && n.occupied(bounds))
+                {
+                    push(n, false);
+                }
+            }
+
+            // The lowest ranked child first, its results cut off the others soonest.
+            std::reverse(m_stack.begin() + pushed, m_stack.end());
+
+            return prefetch_next();
+        }
+
+    private:
+        struct Entry
+        {
+            Node const* node;
+            bool contained;
+        };
+
+        static void prefetch(void const* data, std::size_t const size)
+        {
+            const auto first = static_cast<char const*>(data);
+            const auto last = first + std::min(size, prefetch_lines * 64);
+            for(auto line = first; line < last; line += 64)
+            {
+                _mm_prefetch(line, _MM_HINT_T0);
+            }
+        }
+
+        // The values of a leaf inside the region.
+        template<typename OutIter, typename Filter>
+        static void report_leaf(Node const& node, OutIter& out_it, Filter const& filter)
+        {
+            for(auto& n : node.leaf)
+            {
+                if(n.rank > out_it.get_max_rank()) { break; }
+                if(filter.accept(n))
+                {
+                    *out_it = n;
+                }
+            }
+        }
+
+        void push(Node const& node, bool contained)
+        {
+            Entry e = { &node, contained };
+            m_stack.push_back(e);
+        }
+
+        // Prefetches the node the next step searches.  Returns false if there is none.
+        bool prefetch_next() const
+        {
+            if(m_stack.empty()) { return false; }
+
+            auto& node = *m_stack.back().node;
+            if(node.is_leaf()) { prefetch(node.leaf.data(), node.leaf.size() * sizeof(Value)); }
+            else { prefetch(node.nodes.data(), node.nodes.size() * sizeof(Node)); }
+
+            return true;
+        }
+
+        Region const* m_region;
+        std::vector<Entry> m_stack;
+    };
+
+private:
     struct subtree_elements_counts
     {
         subtree_elements_counts(std::size_t max_count_, std::size_t min_count_) : max_count(max_count_), min_count(min_count_) {}
@@ -89,7 +438,7 @@ private:
     };
 
     template <typename Iterator>
-    void build(Iterator points_begin, Iterator points_end)
+    void build(Iterator points_begin, Iterator points_end, split_options split)
     {
         m_values_count = std::distance(points_begin, points_end);
         if(m_values_count == 0) { return; }
@@ -102,15 +451,18 @@ private:
         const auto elements_count = calculate_subtree_elements_counts(m_values_count, m_parameters, m_height);
         nodesToSearch.reserve(elements_count.max_count);
 
+        split.set_bounds(m_root.mbr);
+
         auto dim = get_longest_edge(m_root.mbr);
-        generate_subtree(points_begin, points_end, m_root.mbr, m_values_count, elements_count, m_root, dim, m_parameters);
+        generate_subtree(points_begin, points_end, m_root.mbr, m_values_count, elements_count, m_root, dim, m_parameters, split);
 
         sort_subtree(m_root, [](Node const& n1, Node const& n2) { return n1.rank < n2.rank; } );
     }
 
     template <typename EIt> inline static
     void generate_subtree(EIt first, EIt last, Rect const& super_mbr, std::size_t values_count, 
-                            subtree_elements_counts const& subtree_counts, Node& subtree, std::size_t dim, Parameters const& parameters)
+                            subtree_elements_counts const& subtree_counts, Node& subtree, std::size_t dim, Parameters const& parameters,
+                            split_options const& split)
     {
         assert(static_cast<std::size_t>(std::distance(first, last)) == values_count);
 
@@ -125,8 +477,16 @@ private:
                 subtree.leaf.push_back(e);
                 extend_bounds(subtree.mbr, e);
                 if(subtree.rank > e.rank) { subtree.rank = e.rank; }
+                if(subtree.max_rank < e.rank) { subtree.max_rank = e.rank; }
+                subtree.ids.insert(e.id);
+            }
+
+            for(auto& e : subtree.leaf)
+            {
+                subtree.occupancy.add(subtree.mbr, e);
             }
 
+            subtree.count = static_cast<uint32_t>(values_count);
             return;
         }
 
@@ -138,14 +498,20 @@ private:
         subtree.nodes.reserve(nodes_count);
 
         partition_subtree(first, last, super_mbr, values_count, subtree_counts, next_subtree_counts,
-            subtree, dim, parameters);
+            subtree, dim, parameters, split);
+
+        // The partitioning only reorders [first, last), the values of the subtree.
+        for(; first != last; ++first)
+        {
+            subtree.occupancy.add(subtree.mbr, *first);
+        }
     }
 
     template <typename EIt> inline static
     void partition_subtree(EIt first, EIt last, Rect const& super_mbr, std::size_t values_count,
                            subtree_elements_counts const& subtree_counts,
                            subtree_elements_counts const& next_subtree_counts,
-                           Node & elements, std::size_t dim, Parameters const& parameters)
+                           Node & elements, std::size_t dim, Parameters const& parameters, split_options const& split)
     {
         assert(std::distance(first, last) > 0 && static_cast<std::size_t>(std::distance(first, last)) == values_count);
 
@@ -158,15 +524,18 @@ private:
 
             dim = (dim + 1) % 2;
 
-            generate_subtree(first, last, super_mbr, values_count, next_subtree_counts, n, dim, parameters);
+            generate_subtree(first, last, super_mbr, values_count, next_subtree_counts, n, dim, parameters, split);
 
             extend_bounds(elements.mbr, n.mbr);
             if(elements.rank > n.rank) { elements.rank = n.rank; }
+            if(elements.max_rank < n.max_rank) { elements.max_rank = n.max_rank; }
+            elements.ids.extend(n.ids);
+            elements.count += n.count;
 
             return;
         }
         
-        const auto median_count = calculate_median(values_count, subtree_counts);
+        const auto median_count = split_values(first, last, values_count, subtree_counts, dim, split);
         auto median = first + median_count;
 
         auto first_med_mbr = super_mbr; 
@@ -174,26 +543,49 @@ private:
 
         if(dim == 0)
         {
-            nth_element_dimension<0>(first, median, last);
             split_mbr<0>(first, median, first_med_mbr, med_last_mbr);
         }
         else
         {
-            nth_element_dimension<1>(first, median, last);
             split_mbr<1>(first, median, first_med_mbr, med_last_mbr);
         }
         
         partition_subtree(first, median, first_med_mbr, median_count, subtree_counts, next_subtree_counts,
-                          elements, dim, parameters);
+                          elements, dim, parameters, split);
         partition_subtree(median, last, med_last_mbr, values_count - median_count, subtree_counts, next_subtree_counts,
-                          elements, dim, parameters);
+                          elements, dim, parameters, split);
+    }
+
+    // Partitions the values for the split and returns the number on the lower side.  Only whole subtrees go to the lower
+    // side, the remainder is left to the upper one.
+    template <typename EIt> inline static
+    std::size_t split_values(EIt first, EIt last, std::size_t values_count, subtree_elements_counts const& subtree_counts,
+                             std::size_t& dim, split_options const& split)
+    {
+        if(split.strategy != split_strategy::median)
+        {
+            const auto count = split_elements(first, last, dim, split, subtree_counts.max_count, subtree_counts.max_count, subtree_counts.min_count,
+                                              [](Value const& v) -> Value const& { return v; });
+            if(count > 0) { return count; }
+        }
+
+        const auto median_count = calculate_median(values_count, subtree_counts);
+        if(dim == 0)
+        {
+            nth_element_dimension<0>(first, first + median_count, last);
+        }
+        else
+        {
+            nth_element_dimension<1>(first, first + median_count, last);
+        }
+
+        return median_count;
     }
 
-   
     template<std::size_t I, typename EIt> inline static
     void nth_element_dimension(EIt first, EIt n, EIt last)
     {
-        typedef std::iterator_traits<EIt>::value_type it_value_type; 
+        typedef typename std::iterator_traits<EIt>::value_type it_value_type; 
         std::nth_element(first, n, last, [](it_value_type const& lhs, it_value_type const& rhs) { return get_dim_coord<I>(lhs) < get_dim_coord<I>(rhs); });
     }
 
@@ -361,9 +753,37 @@ private:
         }
     }
 
-    template<typename OutIter>
-    void query_iterative(Rect const& region, OutIter& out_it)
+    inline static
+    std::size_t count_leaf(Node const& node, Rect const& region)
     {
+        std::size_t result = 0;
+        for(const auto& p : node.leaf)
+        {
+            if(contains(region, p)) { ++result; }
+        }
+
+        return result;
+    }
+
+    template<typename Region, typename OutIter, typename Filter> inline static
+    void query_leaf(Node const& node, Region const& region, OutIter& out_it, Filter const& filter)
+    {
+        for(const auto& p : node.leaf)
+        {
+            if(p.rank > out_it.get_max_rank()) { break; }
+
+            if(contains(region, p) && filter.accept(p))
+            {
+                *out_it = p;
+            }
+        }
+    }
+
+    template<typename Region, typename OutIter, typename Filter>
+    void query_iterative(Region const& region, OutIter& out_it, Filter const& filter)
+    {
+        auto const& bounds = get_bounds(region);
+
         nodesToSearch.push_back(&m_root);
 
         while(!nodesToSearch.empty())
@@ -375,6 +795,7 @@ private:
             for(auto& node : nodes)
             {
                 if(node.rank > out_it.get_max_rank()) { break; }
+                if(!filter.accept_node(node)) { continue; }
 
                 const auto& mbr = node.mbr;
                 if(intersects(region, mbr))
@@ -395,30 +816,32 @@ private:
                                 for(auto& n : contained_node.leaf)
                                 {
                                     if(n.rank > out_it.get_max_rank()) { break; }
-                                    *out_it = n;
+                                    if(filter.accept(n))
+                                    {
+                                        *out_it = n;
+                                    }
                                 }
                             }
                             else
                             {
                                 for(auto& n : contained_node.nodes)
                                 {
-                                    if(node.rank > out_it.get_max_rank()) { break; }
-                                    nodesToSearch.push_back(&n);
+                                    if(n.rank > out_it.get_max_rank()) { break; }
+                                    if(filter.accept_node(n))
+                                    {
+                                        nodesToSearch.push_back(&n);
+                                    }
                                 }
                             }
                         }
                     }
+                    else if(!node.occupied(bounds))
+                    {
+                        continue;
+                    }
                     else if(node.is_leaf())
                     {
-                        for(const auto& p : node.leaf)
-                        {
-                            if(p.rank > out_it.get_max_rank()) { break; }
-
-                            if(contains(region, p))
-                            {
-                                *out_it = p;
-                            }
-                        }
+                        query_leaf(node, region, out_it, filter);
                     }
                     else
                     {
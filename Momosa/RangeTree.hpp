@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <functional>
+#include <assert.h>
+
+#include <ppl.h>
+
+#include "point_utils.hpp"
+
+//
+// Range tree over x whose secondary structures are priority search trees on y, heap ordered by rank.
+//
+// The points are sorted by x and split into aligned blocks of bucket_size << level points.  Every block above the leaf
+// buckets keeps a priority search tree of its points: each node holds the lowest ranked point of its subtree and the
+// rest are split by y between its children.  A query covers its x range with O(log n) blocks and walks all of their
+// trees best first by rank, so only nodes on the two y boundary paths of each tree are visited without being reported.
+// The top k are found in O(log^2 n + k log k), whatever the shape of the rect or the distribution of the points.  The
+// partial buckets at both ends of the x range are scanned.
+//
+// Memory is one index and one split value per point per level, O(n log(n / bucket_size)).
+//
+class RangeTree
+{
+public:
+    static const std::size_t bucket_size = 1024;
+
+    RangeTree() {}
+
+    template <typename Iterator>
+    RangeTree(Iterator points_begin, Iterator points_end)
+    {
+        build(points_begin, points_end);
+    }
+
+    template<typename OutIter>
+    void query(Rect const& region, OutIter& out_it)
+    {
+        if(m_points.empty()) { return; }
+
+        const auto first = std::lower_bound(m_points.begin(), m_points.end(), region.lx, [](Point const& p, float v) { return p.x < v; });
+        const auto last = std::upper_bound(first, m_points.end(), region.hx, [](float v, Point const& p) { return v < p.x; });
+
+        const auto num_points = static_cast<uint32_t>(m_points.size());
+        const auto lo = static_cast<uint32_t>(first - m_points.begin());
+        const auto hi = static_cast<uint32_t>(last - m_points.begin());
+
+        // The blocks cover whole buckets, the last one may be short.
+        const auto block_lo = static_cast<uint32_t>((lo + bucket_size - 1) / bucket_size * bucket_size);
+        const auto block_hi = hi == num_points ? num_points : static_cast<uint32_t>(hi / bucket_size * bucket_size);
+
+        m_queue.clear();
+
+        if(block_lo >= block_hi)
+        {
+            query_bucket(lo, hi, region, out_it);
+            return;
+        }
+
+        query_bucket(lo, block_lo, region, out_it);
+        query_bucket(block_hi, hi, region, out_it);
+
+        for(auto start = block_lo; start < block_hi; )
+        {
+            // Largest block aligned at start that does not pass block_hi.
+            std::size_t level = 0;
+            while(level + 1 < m_levels.size() && start % block_size(level + 1) == 0 && block_end(level + 1, start) <= block_hi)
+            {
+                ++level;
+            }
+
+            push(level, start, 0);
+            start = block_end(level, start);
+        }
+
+        while(!m_queue.empty())
+        {
+            const auto entry = m_queue.front();
+            auto const& p = m_points[m_levels[entry.level].index[entry.start + entry.node]];
+
+            // Nodes are popped in rank order, none of the remaining can improve the results.
+            if(!out_it.can_add(p)) { break; }
+
+            std::pop_heap(m_queue.begin(), m_queue.end(), std::greater<Entry>());
+            m_queue.pop_back();
+
+            if(p.y >= region.ly && p.y <= region.hy)
+            {
+                *out_it = p;
+            }
+
+            const auto size = block_end(entry.level, entry.start) - entry.start;
+            const auto split = m_levels[entry.level].split[entry.start + entry.node];
+
+            const auto left = 2 * entry.node + 1;
+            const auto right = left + 1;
+
+            if(left < size && region.ly <= split) { push(entry.level, entry.start, left); }
+            if(right < size && region.hy >= split) { push(entry.level, entry.start, right); }
+        }
+    }
+
+    std::size_t get_num_points() const { return m_points.size(); }
+
+private:
+    struct Entry
+    {
+        int32_t rank;
+        uint32_t level;
+        uint32_t start;
+        uint32_t node;
+    };
+
+    struct Level
+    {
+        std::vector<uint32_t> index; // Position in m_points of the point held by each node.
+        std::vector<float> split;    // Largest y in the left subtree of each node.
+    };
+
+    template <typename Iterator>
+    void build(Iterator points_begin, Iterator points_end)
+    {
+        m_points.assign(points_begin, points_end);
+        if(m_points.empty()) { return; }
+
+        concurrency::parallel_sort(m_points.begin(), m_points.end(), [](Point const& p1, Point const& p2) { return p1.x < p2.x; } );
+
+        const auto num_points = static_cast<uint32_t>(m_points.size());
+
+        // Partial buckets at the ends of a query are scanned, every whole bucket and larger aligned block has a tree.
+        m_levels.emplace_back();
+        while(block_size(m_levels.size() - 1) < num_points)
+        {
+            m_levels.emplace_back();
+        }
+
+        for(std::size_t level = 0; level < m_levels.size(); ++level)
+        {
+            auto& l = m_levels[level];
+            l.index.resize(num_points);
+            l.split.resize(num_points);
+
+            const auto num_blocks = static_cast<uint32_t>((num_points + block_size(level) - 1) / block_size(level));
+            concurrency::parallel_for(uint32_t(0), num_blocks, [&](uint32_t block)
+            {
+                const auto start = static_cast<uint32_t>(block * block_size(level));
+                const auto end = block_end(level, start);
+
+                std::vector<uint32_t> by_y(end - start);
+                for(uint32_t i = 0; i < by_y.size(); ++i) { by_y[i] = start + i; }
+                std::sort(by_y.begin(), by_y.end(), [&](uint32_t i1, uint32_t i2) { return m_points[i1].y < m_points[i2].y; });
+
+                build_tree(l, start, end - start, 0, by_y.begin(), by_y.end());
+            });
+        }
+    }
+
+    // Builds the subtree at node from the points in [first, last), which are sorted by y.  The trees are complete binary
+    // trees laid out breadth first, so the children of node are 2 * node + 1 and 2 * node + 2.
+    void build_tree(Level& l, uint32_t const start, uint32_t const size, uint32_t const node, std::vector<uint32_t>::iterator first, std::vector<uint32_t>::iterator last)
+    {
+        assert(static_cast<uint32_t>(last - first) == subtree_size(node, size));
+
+        // Move the lowest ranked point to the front, keeping the rest sorted by y.
+        auto min_it = std::min_element(first, last, [&](uint32_t i1, uint32_t i2) { return m_points[i1].rank < m_points[i2].rank; });
+        std::rotate(first, min_it, min_it + 1);
+
+        l.index[start + node] = *first;
+
+        const auto left = 2 * node + 1;
+        if(left >= size)
+        {
+            l.split[start + node] = m_points[*first].y;
+            return;
+        }
+
+        const auto middle = first + 1 + subtree_size(left, size);
+        l.split[start + node] = m_points[*(middle - 1)].y;
+
+        build_tree(l, start, size, left, first + 1, middle);
+        if(middle != last)
+        {
+            build_tree(l, start, size, left + 1, middle, last);
+        }
+    }
+
+    static uint32_t subtree_size(uint32_t const node, uint32_t const size)
+    {
+        uint32_t result = 0;
+        for(uint64_t lo = node, hi = node; lo < size; lo = 2 * lo + 1, hi = 2 * hi + 2)
+        {
+            result += static_cast<uint32_t>(std::min<uint64_t>(hi, size - 1) - lo + 1);
+        }
+
+        return result;
+    }
+
+    template<typename OutIter>
+    void query_bucket(uint32_t const first, uint32_t const last, Rect const& region, OutIter& out_it)
+    {
+        for(auto i = first; i < last; ++i)
+        {
+            auto const& p = m_points[i];
+            if(p.y >= region.ly && p.y <= region.hy && out_it.can_add(p))
+            {
+                *out_it = p;
+            }
+        }
+    }
+
+    void push(std::size_t const level, uint32_t const start, uint32_t const node)
+    {
+        Entry entry;
+        entry.rank = m_points[m_levels[level].index[start + node]].rank;
+        entry.level = static_cast<uint32_t>(level);
+        entry.start = start;
+        entry.node = node;
+
+        m_queue.push_back(entry);
+        std::push_heap(m_queue.begin(), m_queue.end(), std::greater<Entry>());
+    }
+
+    std::size_t block_size(std::size_t const level) const { return bucket_size << level; }
+
+    uint32_t block_end(std::size_t const level, uint32_t const start) const
+    {
+        return static_cast<uint32_t>(std::min<std::size_t>(start + block_size(level), m_points.size()));
+    }
+
+private:
+    std::vector<Point> m_points;
+    std::vector<Level> m_levels;
+    std::vector<Entry> m_queue; // Min heap on rank of the nodes still to visit.
+};
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <ppl.h>
+
+#include "learned_index.hpp"
+#include "point_utils.hpp"
+#include "query_filters.hpp"
+#include "regions.hpp"
+
+//
+// The points sorted along dimension I for the linear search of a slab.  The sorted points are cut into blocks of
+// block_size points, each then sorted by rank, and every block keeps its mbr and lowest rank.
+//
+// A search collects the blocks of the slab whose mbr intersects the region, which skips the blocks that miss it along
+// the other dimension, and scans them lowest rank first.  The scan of a block stops at the first point that cannot
+// improve the results and the search stops at the first block that cannot.
+//
+template<std::size_t I>
+class RankBlockedSlab
+{
+public:
+    static const uint32_t block_size = 64;
+
+    RankBlockedSlab() {}
+
+    template<typename Iterator>
+    RankBlockedSlab(Iterator first, Iterator last)
+        : m_points(first, last)
+    {
+        build();
+    }
+
+    std::size_t size() const { return m_points.size(); }
+
+    template<typename Region, typename OutIter, typename Filter>
+    void query(Region const& region, OutIter& out, Filter const& filter)
+    {
+        auto const& bounds = get_bounds(region);
+
+        m_candidates.clear();
+        for(auto b = first_block(get_dim_coord_lo<I>(bounds)); b < m_blocks.size(); ++b)
+        {
+            auto const& block = m_blocks[b];
+            if(get_dim_coord_lo<I>(block.mbr) > get_dim_coord_hi<I>(bounds)) { break; }
+
+            if(block.rank > out.get_max_rank() || !intersects(region, block.mbr)) { continue; }
+            m_candidates.push_back(b);
+        }
+
+        const auto higher_rank = [&](uint32_t b1, uint32_t b2) { return m_blocks[b1].rank > m_blocks[b2].rank; };
+        std::make_heap(m_candidates.begin(), m_candidates.end(), higher_rank);
+
+        while(!m_candidates.empty())
+        {
+            auto const& block = m_blocks[m_candidates.front()];
+            std::pop_heap(m_candidates.begin(), m_candidates.end(), higher_rank);
+            m_candidates.pop_back();
+
+            // Blocks are in rank order, none of the remaining ones can improve the results.
+            if(block.rank > out.get_max_rank() || !out.can_add(m_points[block.first])) { break; }
+            if(has_expired(filter)) { break; }
+
+            const bool inside = contains(region, block.mbr);
+            for(auto i = block.first; i < block.last; ++i)
+            {
+                auto const& p = m_points[i];
+                if(p.rank > out.get_max_rank() || !out.can_add(p)) { break; }
+
+                if((inside || contains(region, p)) && filter.accept(p))
+                {
+                    *out = p;
+                }
+            }
+        }
+    }
+
+    // Number of points inside the region.  Blocks contained by the region add their size without being scanned.
+    std::size_t count(Rect const& region) const
+    {
+        std::size_t result = 0;
+
+        for(auto b = first_block(get_dim_coord_lo<I>(region)); b < m_blocks.size(); ++b)
+        {
+            auto const& block = m_blocks[b];
+            if(get_dim_coord_lo<I>(block.mbr) > get_dim_coord_hi<I>(region)) { break; }
+
+            if(!intersects(region, block.mbr)) { continue; }
+
+            if(contains(region, block.mbr))
+            {
+                result += block.last - block.first;
+                continue;
+            }
+
+            result += std::count_if(m_points.begin() + block.first, m_points.begin() + block.last, [&](Point const& p) { return contains(region, p); });
+        }
+
+        return result;
+    }
+
+    std::size_t size_in_bytes() const
+    {
+        return m_points.size() * sizeof(Point) + m_blocks.size() * sizeof(Block) + m_block_index.size_in_bytes();
+    }
+
+private:
+    struct Block
+    {
+        Rect mbr;
+        int32_t rank;
+        uint32_t first;
+        uint32_t last;
+    };
+
+    void build()
+    {
+        concurrency::parallel_sort(m_points.begin(), m_points.end(), [](Point const& p1, Point const& p2) { return get_dim_coord<I>(p1) < get_dim_coord<I>(p2); });
+
+        const auto num_points = static_cast<uint32_t>(m_points.size());
+        const auto num_blocks = (num_points + block_size - 1) / block_size;
+
+        m_blocks.resize(num_blocks);
+        concurrency::parallel_for(uint32_t(0), num_blocks, [&](uint32_t b)
+        {
+            auto& block = m_blocks[b];
+            block.first = b * block_size;
+            block.last = std::min(num_points, block.first + block_size);
+
+            initialize(block.mbr);
+            std::for_each(m_points.begin() + block.first, m_points.begin() + block.last, [&](Point const& p) { extend_bounds(block.mbr, p); });
+
+            std::sort(m_points.begin() + block.first, m_points.begin() + block.last);
+            block.rank = m_points[block.first].rank;
+        });
+
+        m_block_index.build(m_blocks.begin(), m_blocks.end(), block_hi);
+    }
+
+    static float block_hi(Block const& block) { return get_dim_coord_hi<I>(block.mbr); }
+
+    // The blocks are in order along I, so is the high end of their mbrs.
+    std::size_t first_block(float const lo) const
+    {
+        return m_block_index.lower_bound(m_blocks.begin(), m_blocks.end(), lo, block_hi) - m_blocks.begin();
+    }
+
+private:
+    std::vector<Point> m_points;    // Blocks in order along I, in rank order within a block.
+    std::vector<Block> m_blocks;
+    LearnedIndex m_block_index;     // Over the high ends of the block mbrs along I.
+
+    std::vector<uint32_t> m_candidates;
+};
@@ -18,22 +18,143 @@
 
 #include "SearchContextImpl.hpp"
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+
 class SearchContext
 {
 public:
-    SearchContext(Point const* points_begin, Point const* points_end) 
-        : m_impl(points_begin, points_end)
+    SearchContext(Point const* points_begin, Point const* points_end, BuildOptions const& options = BuildOptions()) 
+        : m_impl(std::make_shared<SearchContextRTree>(points_begin, points_end, options))
+        , m_options(options)
+        , m_rebuilding(false)
     {
     }
 
-    ~SearchContext() {}
+    ~SearchContext() 
+    {
+        rebuild_wait();
+    }
 
     int32_t search(Rect const& rect, int32_t const count, Point* out_points)
     {
-        auto results = m_impl.search(rect, count, out_points);
+        auto impl = std::atomic_load(&m_impl);
+        auto results = impl->search(rect, count, out_points);
         return results;
     }
 
+    int32_t search_rank_range(Rect const& rect, int32_t const rank_lo, int32_t const rank_hi, int32_t const count, Point* out_points)
+    {
+        auto impl = std::atomic_load(&m_impl);
+        return impl->search_rank_range(rect, rank_lo, rank_hi, count, out_points);
+    }
+
+    int32_t search_filtered(Rect const& rect, id_set const& ids, int32_t const count, Point* out_points)
+    {
+        auto impl = std::atomic_load(&m_impl);
+        return impl->search_filtered(rect, ids, count, out_points);
+    }
+
+    int32_t search_deadline(Rect const& rect, int32_t const count, Point* out_points, int64_t const budget_ns, bool* complete)
+    {
+        auto impl = std::atomic_load(&m_impl);
+        return impl->search_deadline(rect, count, out_points, budget_ns, complete);
+    }
+
+    int32_t search_approximate(Rect const& rect, int32_t const count, Point* out_points, float const recall, float* estimated_recall)
+    {
+        auto impl = std::atomic_load(&m_impl);
+        return impl->search_approximate(rect, count, out_points, recall, estimated_recall);
+    }
+
+    int32_t count(Rect const& rect)
+    {
+        auto impl = std::atomic_load(&m_impl);
+        return impl->count(rect);
+    }
+
+    template<typename Region>
+    int32_t search_region(Region const& region, int32_t const count, Point* out_points)
+    {
+        auto impl = std::atomic_load(&m_impl);
+        return impl->search_region(region, count, out_points);
+    }
+
+    int32_t search_batch(Rect const* rects, int32_t const num_rects, int32_t const count, Point* out_points, int32_t* out_counts)
+    {
+        auto impl = std::atomic_load(&m_impl);
+        return impl->search_batch(rects, num_rects, count, out_points, out_counts);
+    }
+
+    // The parameters the current index was built with.
+    EngineParameters parameters() const
+    {
+        auto impl = std::atomic_load(&m_impl);
+        return impl->parameters();
+    }
+
+    // The index searches are currently running against.  After a rebuild it is reclaimed once no one holds on to it.
+    std::shared_ptr<SearchContextRTree> snapshot() const
+    {
+        return std::atomic_load(&m_impl);
+    }
+
+    // Builds a new index from the points on a background thread while searches continue on the current one. Returns
+    // false if a rebuild is already in progress.  May be called concurrently with rebuild_wait().
+    bool rebuild_async(Point const* points_begin, Point const* points_end)
+    {
+        if(m_rebuilding.exchange(true)) { return false; }
+
+        try
+        {
+            // The input points are only guaranteed to be valid for the duration of the call.
+            std::vector<Point> points(points_begin, points_end);
+
+            // The previous rebuild has published its index, but its thread may still be finishing.
+            std::lock_guard<std::mutex> lock(m_rebuild_mutex);
+            if(m_rebuild_thread.joinable()) { m_rebuild_thread.join(); }
+
+            m_rebuild_thread = std::thread(&SearchContext::rebuild, this, std::move(points));
+        }
+        catch(...)
+        {
+            m_rebuilding = false;
+            throw;
+        }
+
+        return true;
+    }
+
+    // Blocks until the pending rebuild, if any, has been published. Returns false if there was nothing to wait on.
+    bool rebuild_wait()
+    {
+        std::lock_guard<std::mutex> lock(m_rebuild_mutex);
+        if(!m_rebuild_thread.joinable()) { return false; }
+
+        m_rebuild_thread.join();
+        return true;
+    }
+
+private:
+    void rebuild(std::vector<Point> points)
+    {
+        auto impl = std::make_shared<SearchContextRTree>(points.data(), points.data() + points.size(), m_options);
+
+        points.clear();
+        points.shrink_to_fit();
+
+        // Searches that loaded the old index before the swap still hold a reference to it, as do open cursors.  New
+        // searches can no longer reach it, so the last of them to let go of it reclaims it, or this thread if none do.
+        auto old_impl = std::atomic_exchange(&m_impl, impl);
+        m_rebuilding = false;
+    }
+
 private:
-    SearchContextRTree m_impl;
+    std::shared_ptr<SearchContextRTree> m_impl;
+    BuildOptions m_options;
+
+    std::mutex m_rebuild_mutex;     // Guards m_rebuild_thread, which rebuild_async() and rebuild_wait() both join.
+    std::thread m_rebuild_thread;
+    std::atomic<bool> m_rebuilding;
 };
\ No newline at end of file
@@ -20,6 +20,7 @@
 #include "iterators.hpp"
 #include "statistics.hpp"
 #include "profile.hpp"
+#include "rank_space.hpp"
 
 //
 //
@@ -27,14 +28,18 @@
 class SearchContextHashGrid::Impl
 {
 public:
-    Impl(Point const* points_begin, Point const* points_end);
+    Impl(Point const* points_begin, Point const* points_end, BuildOptions const& options);
     ~Impl();
 
     int32_t search_impl(Rect const& rect, int32_t const count, Point* out_points);
+    int32_t search_filtered_impl(Rect const& rect, id_set const& ids, int32_t const count, Point* out_points);
 
 private:
-    template<std::size_t I, typename Iter, class Reporter>
-    void search_linear(Iter first, Iter last, Rect const& region, Reporter& reporter);
+    template<class Filter>
+    int32_t search_impl(Rect const& region, int32_t const count, Filter const& filter, Point* out_points);
+
+    template<std::size_t I, typename Iter, class Reporter, class Filter>
+    void search_linear(Iter first, Iter last, Rect const& region, Reporter& reporter, Filter const& filter);
 
     template<std::size_t I>
     double calculate_contained_percentage(Rect const& region)
@@ -61,9 +66,11 @@ private:
     statistics::Point m_mean;
     statistics::Point m_stddev;
     Rect mbr;
+
+    RankSpace m_rank_space;
 };
 
-SearchContextHashGrid::Impl::Impl(Point const* points_begin, Point const* points_end)
+SearchContextHashGrid::Impl::Impl(Point const* points_begin, Point const* points_end, BuildOptions const& options)
 {
     if(std::distance(points_begin, points_end) <= 0) { return; }
 
@@ -72,6 +79,11 @@ SearchContextHashGrid::Impl::Impl(Point const* points_begin, Point const* points
     points.insert(points.begin(), points_begin, points_end);
     points.erase(std::remove_if(points.begin(), points.end(), [](Point const& p){ return (abs(p.x) > 1.0e9 || abs(p.y) > 1.0e9); }  ), points.end());
 
+    if(options.rank_space && m_rank_space.build(points.begin(), points.end()))
+    {
+        concurrency::parallel_for_each(points.begin(), points.end(), [this](Point& p) { p = m_rank_space.to_rank_space(p); });
+    }
+
     concurrency::parallel_sort(points.begin(), points.end());
 
     m_points[0] = points;
@@ -100,15 +112,15 @@ SearchContextHashGrid::Impl::~Impl()
 {
 }
 
-template<std::size_t I, typename Iter, class Reporter>
-void SearchContextHashGrid::Impl::search_linear(Iter first, Iter last, Rect const& region, Reporter& reporter)
+template<std::size_t I, typename Iter, class Reporter, class Filter>
+void SearchContextHashGrid::Impl::search_linear(Iter first, Iter last, Rect const& region, Reporter& reporter, Filter const& filter)
 {
     auto start = std::lower_bound(first, last, get_dim_coord_lo<I>(region), [](Point const& p, float v) { return get_dim_coord<I>(p) < v; });
     for(; start != last && get_dim_coord<I>(*start) <= get_dim_coord_hi<I>(region); ++start)
     {
         auto& p = *start;
         static const std::size_t K = (I + 1) % 2;
-        if(get_dim_coord<K>(p) >= get_dim_coord_lo<K>(region) && get_dim_coord<K>(p) <= get_dim_coord_hi<K>(region))
+        if(get_dim_coord<K>(p) >= get_dim_coord_lo<K>(region) && get_dim_coord<K>(p) <= get_dim_coord_hi<K>(region) && filter.accept(p))
         {
             *reporter = p;
         }
@@ -117,11 +129,24 @@ void SearchContextHashGrid::Impl::search_linear(Iter first, Iter last, Rect cons
 
 int32_t SearchContextHashGrid::Impl::search_impl(Rect const& region, int32_t const count, Point* out_points)
 {
+    return search_impl(region, count, no_filter(), out_points);
+}
+
+int32_t SearchContextHashGrid::Impl::search_filtered_impl(Rect const& region, id_set const& ids, int32_t const count, Point* out_points)
+{
+    return search_impl(region, count, id_filter(ids), out_points);
+}
+
+template<class Filter>
+int32_t SearchContextHashGrid::Impl::search_impl(Rect const& rect, int32_t const count, Filter const& filter, Point* out_points)
+{
+    if(count <= 0) { return 0; }
     if(m_hashgrid.use_count() == 0) { return 0; }
+
+    const auto region = m_rank_space.enabled() ? m_rank_space.to_rank_space(rect) : rect;
     if(!intersects(region, mbr)) { return 0; }
 
-    m_results.clear();
-    m_results.reserve(count);
+    reset_results(m_results, count);
 
     auto reporter = min_constrained_inserter(m_results);
 
@@ -132,7 +157,7 @@ int32_t SearchContextHashGrid::Impl::search_impl(Rect const& region, int32_t con
 
     if(1)//num_points_probability > linear_search_threshold)
     {
-        m_hashgrid->query(region, reporter);
+        m_hashgrid->query(region, reporter, filter);
     }
     else
     {
@@ -141,25 +166,30 @@ int32_t SearchContextHashGrid::Impl::search_impl(Rect const& region, int32_t con
 
         if(dim == 0)
         {
-            search_linear<0>(first, last, region, reporter);
+            search_linear<0>(first, last, region, reporter, filter);
         }
         else
         {
-            search_linear<1>(first, last, region, reporter);
+            search_linear<1>(first, last, region, reporter, filter);
         }
     }
 
     std::sort(m_results.begin(), m_results.end());
     memcpy(out_points, m_results.data(), sizeof(Point)*m_results.size());
 
+    if(m_rank_space.enabled())
+    {
+        std::transform(out_points, out_points + m_results.size(), out_points, [this](Point const& p) { return m_rank_space.from_rank_space(p); });
+    }
+
     return static_cast<int32_t>(m_results.size());
 }
 
 //
 //
 //
-SearchContextHashGrid::SearchContextHashGrid(Point const* points_begin, Point const* points_end) 
-    : m_impl(new SearchContextHashGrid::Impl(points_begin, points_end))
+SearchContextHashGrid::SearchContextHashGrid(Point const* points_begin, Point const* points_end, BuildOptions const& options) 
+    : m_impl(new SearchContextHashGrid::Impl(points_begin, points_end, options))
 {
 }
 
@@ -171,3 +201,8 @@ int32_t SearchContextHashGrid::search_impl(Rect const& rect, int32_t const count
 {
     return m_impl->search_impl(rect, count, out_points);
 }
+
+int32_t SearchContextHashGrid::search_filtered_impl(Rect const& rect, id_set const& ids, int32_t const count, Point* out_points)
+{
+    return m_impl->search_filtered_impl(rect, ids, count, out_points);
+}
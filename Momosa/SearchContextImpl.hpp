@@ -17,9 +17,53 @@
 #pragma once
 
 #include "point_search.h"
+#include "query_filters.hpp"
+#include "regions.hpp"
+#include "split_strategy.hpp"
 #include <vector>
 #include <memory>
 
+// Sizes the RTree engine is built with.  The defaults were tuned for 10M uniformly distributed points.
+struct EngineParameters
+{
+    EngineParameters() : max_leaf_elements(80), max_elements(40), partition_size(200000), first_partition_size(0), partition_growth(4), linear_search_threshold(1000) {}
+
+    std::size_t max_leaf_elements;          // Points per tree leaf.
+    std::size_t max_elements;               // Children per tree node.
+    std::size_t partition_size;             // Points per rank partition, one tree each.
+
+    // Partitions start at first_partition_size points and grow by partition_growth up to partition_size, so the most
+    // important points are in small trees.  0 for all partitions of partition_size.
+    std::size_t first_partition_size;
+    std::size_t partition_growth;
+
+    std::size_t linear_search_threshold;    // Rects expected to hold fewer points in a slab are searched linearly.
+};
+
+// Options applied when building an engine, see create_ex().
+struct BuildOptions
+{
+    BuildOptions() : rank_space(false), auto_tune(false), tune_count(20), hybrid_partitions(false) {}
+
+    // Index the rank of each coordinate among the points instead of the coordinate, see rank_space.hpp.
+    bool rank_space;
+
+    // How the trees split their nodes, see split_strategy.hpp.
+    split_options split;
+
+    // Used as is unless auto_tune is set.
+    EngineParameters parameters;
+
+    // Choose the parameters by timing candidates on a sample of the points, see auto_tune.hpp.  The queries timed are
+    // tune_queries, or a synthetic mix if there are none, each for the top tune_count points.
+    bool auto_tune;
+    std::vector<Rect> tune_queries;
+    int32_t tune_count;
+
+    // Let each rank partition choose its engine, an R-tree, a dense grid or a flat scan, see Partition.hpp.  Hot
+    // partitions are timed on the same queries as auto_tune.
+    bool hybrid_partitions;
+};
 
 template<class T>
 class SearchContextImpl
@@ -29,14 +73,64 @@ public:
     {
         return static_cast<T*>(this)->search_impl(rect, count, out_points);
     }
+
+    int32_t search_rank_range(Rect const& rect, int32_t const rank_lo, int32_t const rank_hi, int32_t const count, Point* out_points) 
+    {
+        return static_cast<T*>(this)->search_rank_range_impl(rect, rank_lo, rank_hi, count, out_points);
+    }
+
+    int32_t search_filtered(Rect const& rect, id_set const& ids, int32_t const count, Point* out_points) 
+    {
+        return static_cast<T*>(this)->search_filtered_impl(rect, ids, count, out_points);
+    }
+
+    // Stops after roughly budget_ns nanoseconds with the best points found so far.  complete is set to false if the
+    // search was cut short and the results may not be the top points.
+    int32_t search_deadline(Rect const& rect, int32_t const count, Point* out_points, int64_t const budget_ns, bool* complete)
+    {
+        return static_cast<T*>(this)->search_deadline_impl(rect, count, out_points, budget_ns, complete);
+    }
+
+    // Trades accuracy for speed by skipping partitions once the expected recall reaches "recall".  The estimate of
+    // the recall achieved is stored in estimated_recall.
+    int32_t search_approximate(Rect const& rect, int32_t const count, Point* out_points, float const recall, float* estimated_recall)
+    {
+        return static_cast<T*>(this)->search_approximate_impl(rect, count, out_points, recall, estimated_recall);
+    }
+
+    int32_t count(Rect const& rect)
+    {
+        return static_cast<T*>(this)->count_impl(rect);
+    }
+
+    template<typename Region>
+    int32_t search_region(Region const& region, int32_t const count, Point* out_points)
+    {
+        return static_cast<T*>(this)->search_region_impl(region, std::numeric_limits<int32_t>::max(), count, out_points);
+    }
+
+    // Only points with a rank up to and including max_rank are considered.
+    template<typename Region>
+    int32_t search_region(Region const& region, int32_t const max_rank, int32_t const count, Point* out_points)
+    {
+        return static_cast<T*>(this)->search_region_impl(region, max_rank, count, out_points);
+    }
+
+    // Searches num_rects rects at once, the results of rect i go to out_points + i * count and their number to
+    // out_counts[i].  Returns the number of points found over all of the rects.
+    int32_t search_batch(Rect const* rects, int32_t const num_rects, int32_t const count, Point* out_points, int32_t* out_counts)
+    {
+        return static_cast<T*>(this)->search_batch_impl(rects, num_rects, count, out_points, out_counts);
+    }
 };
 
 class SearchContextHashGrid: public SearchContextImpl<SearchContextHashGrid>
 {
 public:
-    SearchContextHashGrid(Point const* points_begin, Point const* points_end);
+    SearchContextHashGrid(Point const* points_begin, Point const* points_end, BuildOptions const& options = BuildOptions());
     ~SearchContextHashGrid();
     int32_t search_impl(Rect const& rect, int32_t const count, Point* out_points);
+    int32_t search_filtered_impl(Rect const& rect, id_set const& ids, int32_t const count, Point* out_points);
 
 private:
     class Impl;
@@ -46,9 +140,33 @@ private:
 class SearchContextRTree : public SearchContextImpl<SearchContextRTree>
 {
 public:
-    SearchContextRTree(Point const* points_begin, Point const* points_end);
+    // Reports the points inside a rect in rank order, a page at a time.  Keeps the context it was opened on alive.
+    class Cursor
+    {
+    public:
+        Cursor(std::shared_ptr<SearchContextRTree> const& context, Rect const& rect);
+        ~Cursor();
+        int32_t next(int32_t const count, Point* out_points);
+
+    private:
+        class Impl;
+        std::unique_ptr<Impl> m_impl;
+    };
+
+    SearchContextRTree(Point const* points_begin, Point const* points_end, BuildOptions const& options = BuildOptions());
     ~SearchContextRTree();
     int32_t search_impl(Rect const& rect, int32_t const count, Point* out_points);
+    int32_t search_rank_range_impl(Rect const& rect, int32_t const rank_lo, int32_t const rank_hi, int32_t const count, Point* out_points);
+    int32_t search_filtered_impl(Rect const& rect, id_set const& ids, int32_t const count, Point* out_points);
+    int32_t search_deadline_impl(Rect const& rect, int32_t const count, Point* out_points, int64_t const budget_ns, bool* complete);
+    int32_t search_approximate_impl(Rect const& rect, int32_t const count, Point* out_points, float const recall, float* estimated_recall);
+    int32_t count_impl(Rect const& rect);
+    int32_t search_region_impl(RectUnion const& region, int32_t const max_rank, int32_t const count, Point* out_points);
+    int32_t search_region_impl(ConvexPolygon const& region, int32_t const max_rank, int32_t const count, Point* out_points);
+    int32_t search_batch_impl(Rect const* rects, int32_t const num_rects, int32_t const count, Point* out_points, int32_t* out_counts);
+
+    // The parameters chosen when building, the tuned ones with BuildOptions::auto_tune.
+    EngineParameters const& parameters() const;
 
 private:
     class Impl;
@@ -58,9 +176,65 @@ private:
 class SearchContextKdTree: public SearchContextImpl<SearchContextKdTree>
 {
 public:
-    SearchContextKdTree(Point const* points_begin, Point const* points_end);
+    SearchContextKdTree(Point const* points_begin, Point const* points_end, BuildOptions const& options = BuildOptions());
     ~SearchContextKdTree();
     int32_t search_impl(Rect const& rect, int32_t const count, Point* out_points);
+    int32_t search_filtered_impl(Rect const& rect, id_set const& ids, int32_t const count, Point* out_points);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+// Single kd-tree over all of the points, see ImplicitKdTree.hpp.
+class SearchContextImplicitKdTree : public SearchContextImpl<SearchContextImplicitKdTree>
+{
+public:
+    SearchContextImplicitKdTree(Point const* points_begin, Point const* points_end);
+    ~SearchContextImplicitKdTree();
+    int32_t search_impl(Rect const& rect, int32_t const count, Point* out_points);
+    int32_t search_filtered_impl(Rect const& rect, id_set const& ids, int32_t const count, Point* out_points);
+    std::size_t size_in_bytes() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+// Worst case bounded engine, see RangeTree.hpp.
+class SearchContextRangeTree : public SearchContextImpl<SearchContextRangeTree>
+{
+public:
+    SearchContextRangeTree(Point const* points_begin, Point const* points_end);
+    ~SearchContextRangeTree();
+    int32_t search_impl(Rect const& rect, int32_t const count, Point* out_points);
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+// Memory constrained engine, see WaveletTree.hpp.
+class SearchContextWavelet : public SearchContextImpl<SearchContextWavelet>
+{
+public:
+    SearchContextWavelet(Point const* points_begin, Point const* points_end);
+    ~SearchContextWavelet();
+    int32_t search_impl(Rect const& rect, int32_t const count, Point* out_points);
+    std::size_t size_in_bytes() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+};
+
+// Z-order blocks, see MortonIndex.hpp.
+class SearchContextMorton : public SearchContextImpl<SearchContextMorton>
+{
+public:
+    SearchContextMorton(Point const* points_begin, Point const* points_end);
+    ~SearchContextMorton();
+    int32_t search_impl(Rect const& rect, int32_t const count, Point* out_points);
 
 private:
     class Impl;
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SearchContextImpl.hpp"
+#include "ImplicitKdTree.hpp"
+#include "iterators.hpp"
+
+//
+//
+//
+class SearchContextImplicitKdTree::Impl
+{
+public:
+    Impl(Point const* points_begin, Point const* points_end);
+    ~Impl();
+
+    int32_t search_impl(Rect const& rect, int32_t const count, Point* out_points);
+    int32_t search_filtered_impl(Rect const& rect, id_set const& ids, int32_t const count, Point* out_points);
+    std::size_t size_in_bytes() const { return m_tree.size_in_bytes(); }
+
+private:
+    template<class Filter>
+    int32_t search_impl(Rect const& rect, int32_t const count, Filter const& filter, Point* out_points);
+
+    ImplicitKdTree m_tree;
+    std::vector<Point> m_results;
+};
+
+SearchContextImplicitKdTree::Impl::Impl(Point const* points_begin, Point const* points_end)
+{
+    std::vector<Point> points;
+
+    if(points_begin < points_end)
+    {
+        points.insert(points.begin(), points_begin, points_end);
+        points.erase(std::remove_if(points.begin(), points.end(), [](Point const& p){ return (abs(p.x) > 1.0e9 || abs(p.y) > 1.0e9); }  ), points.end());
+    }
+
+    m_tree = ImplicitKdTree(points.begin(), points.end());
+}
+
+SearchContextImplicitKdTree::Impl::~Impl()
+{
+}
+
+int32_t SearchContextImplicitKdTree::Impl::search_impl(Rect const& rect, int32_t const count, Point* out_points)
+{
+    return search_impl(rect, count, no_filter(), out_points);
+}
+
+int32_t SearchContextImplicitKdTree::Impl::search_filtered_impl(Rect const& rect, id_set const& ids, int32_t const count, Point* out_points)
+{
+    return search_impl(rect, count, id_filter(ids), out_points);
+}
+
+template<class Filter>
+int32_t SearchContextImplicitKdTree::Impl::search_impl(Rect const& rect, int32_t const count, Filter const& filter, Point* out_points)
+{
+    if(count <= 0) { return 0; }
+
+    reset_results(m_results, count);
+
+    auto reporter = min_constrained_inserter(m_results);
+    m_tree.query(rect, reporter, filter);
+
+    std::sort(m_results.begin(), m_results.end());
+    memcpy(out_points, m_results.data(), sizeof(Point)*m_results.size());
+
+    return static_cast<int32_t>(m_results.size());
+}
+
+//
+//
+//
+SearchContextImplicitKdTree::SearchContextImplicitKdTree(Point const* points_begin, Point const* points_end) 
+    : m_impl(new SearchContextImplicitKdTree::Impl(points_begin, points_end))
+{
+}
+
+SearchContextImplicitKdTree::~SearchContextImplicitKdTree() 
+{
+}
+
+int32_t SearchContextImplicitKdTree::search_impl(Rect const& rect, int32_t const count, Point* out_points)
+{
+    return m_impl->search_impl(rect, count, out_points);
+}
+
+int32_t SearchContextImplicitKdTree::search_filtered_impl(Rect const& rect, id_set const& ids, int32_t const count, Point* out_points)
+{
+    return m_impl->search_filtered_impl(rect, ids, count, out_points);
+}
+
+std::size_t SearchContextImplicitKdTree::size_in_bytes() const
+{
+    return m_impl->size_in_bytes();
+}
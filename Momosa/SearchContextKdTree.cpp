@@ -24,19 +24,23 @@
 class SearchContextKdTree::Impl
 {
 public:
-    Impl(const Point* points_begin, const Point* points_end);
+    Impl(const Point* points_begin, const Point* points_end, const BuildOptions& options);
     ~Impl();
 
     int32_t search_impl(const Rect& rect, const int32_t count, Point* out_points);
+    int32_t search_filtered_impl(const Rect& rect, const id_set& ids, const int32_t count, Point* out_points);
 
 private:
+    template<class Filter>
+    int32_t search_impl(const Rect& rect, const int32_t count, const Filter& filter, Point* out_points);
+
     // TODO: calculate optimum size based on point set. Current value seems to be the quickest for 10M points.
     static const size_t bucket_size = 16383;
     std::vector<KdTree> m_trees;
     std::vector<Point> m_results;
 };
 
-SearchContextKdTree::Impl::Impl(const Point* points_begin, const Point* points_end)
+SearchContextKdTree::Impl::Impl(const Point* points_begin, const Point* points_end, const BuildOptions& options)
 {
     std::vector<Point> points;
 
@@ -55,7 +59,7 @@ SearchContextKdTree::Impl::Impl(const Point* points_begin, const Point* points_e
 
     while(startIt != points.end())
     {
-        m_trees.push_back(KdTree(startIt, lastIt));
+        m_trees.push_back(KdTree(startIt, lastIt, options.split));
         startIt = lastIt != points.end() ? lastIt : points.end();
         lastIt = startIt + std::min(bucket_size, static_cast<size_t>(points.end() - startIt));
     }
@@ -68,12 +72,24 @@ SearchContextKdTree::Impl::~Impl()
 
 int32_t SearchContextKdTree::Impl::search_impl(const Rect& rect, const int32_t count, Point* out_points)
 {
-    m_results.clear();
-    m_results.reserve(count);
+    return search_impl(rect, count, no_filter(), out_points);
+}
+
+int32_t SearchContextKdTree::Impl::search_filtered_impl(const Rect& rect, const id_set& ids, const int32_t count, Point* out_points)
+{
+    return search_impl(rect, count, id_filter(ids), out_points);
+}
+
+template<class Filter>
+int32_t SearchContextKdTree::Impl::search_impl(const Rect& rect, const int32_t count, const Filter& filter, Point* out_points)
+{
+    if(count <= 0) { return 0; }
+
+    reset_results(m_results, count);
 
     for(auto it = m_trees.begin(); it != m_trees.end() && m_results.size() < count; ++it)
     {
-        it->query(rect, min_constrained_inserter(m_results));
+        it->query(rect, min_constrained_inserter(m_results), filter);
     }
 
     std::sort(m_results.begin(), m_results.end(), [](const Point& p1, const Point& p2){ return p1 < p2; });
@@ -90,8 +106,8 @@ int32_t SearchContextKdTree::Impl::search_impl(const Rect& rect, const int32_t c
 //
 //
 //
-SearchContextKdTree::SearchContextKdTree(const Point* points_begin, const Point* points_end) 
-    : m_impl(new SearchContextKdTree::Impl(points_begin, points_end))
+SearchContextKdTree::SearchContextKdTree(const Point* points_begin, const Point* points_end, const BuildOptions& options) 
+    : m_impl(new SearchContextKdTree::Impl(points_begin, points_end, options))
 {
 }
 
@@ -103,3 +119,8 @@ int32_t SearchContextKdTree::search_impl(const Rect& rect, const int32_t count,
 {
     return m_impl->search_impl(rect, count, out_points);
 }
+
+int32_t SearchContextKdTree::search_filtered_impl(const Rect& rect, const id_set& ids, const int32_t count, Point* out_points)
+{
+    return m_impl->search_filtered_impl(rect, ids, count, out_points);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ppl.h>
+#include "SearchContextImpl.hpp"
+#include "MortonIndex.hpp"
+#include "iterators.hpp"
+
+//
+//
+//
+class SearchContextMorton::Impl
+{
+public:
+    Impl(Point const* points_begin, Point const* points_end);
+    ~Impl();
+
+    int32_t search_impl(Rect const& rect, int32_t const count, Point* out_points);
+
+private:
+    // The first of the doubling rank partitions, see doubling_rank_partitions().  Large rects are answered from the
+    // first few small partitions without visiting many blocks.
+    static const std::size_t first_partition_size = 1024;
+
+    std::vector<MortonIndex> m_trees;
+    std::vector<Point> m_results;
+};
+
+SearchContextMorton::Impl::Impl(Point const* points_begin, Point const* points_end)
+{
+    std::vector<Point> points;
+    std::vector<std::size_t> starts;
+    doubling_rank_partitions(points_begin, points_end, first_partition_size, points, starts);
+
+    // All partitions share the quantization.
+    Rect bounds;
+    initialize(bounds);
+    for(auto& p : points)
+    {
+        extend_bounds(bounds, p);
+    }
+
+    m_trees.resize(starts.size() - 1);
+    concurrency::parallel_for(std::size_t(0), m_trees.size(), [&](std::size_t i)
+    {
+        m_trees[i] = MortonIndex(points.begin() + starts[i], points.begin() + starts[i + 1], bounds);
+    });
+}
+
+SearchContextMorton::Impl::~Impl()
+{
+}
+
+int32_t SearchContextMorton::Impl::search_impl(Rect const& rect, int32_t const count, Point* out_points)
+{
+    if(count <= 0) { return 0; }
+
+    reset_results(m_results, count);
+
+    auto reporter = min_constrained_inserter(m_results);
+    for(auto& tree : m_trees)
+    {
+        // Partitions are in rank order, none of the remaining ones can improve the results.
+        if(m_results.size() >= m_results.capacity()) { break; }
+
+        tree.query(rect, reporter);
+    }
+
+    std::sort(m_results.begin(), m_results.end());
+    memcpy(out_points, m_results.data(), sizeof(Point)*m_results.size());
+
+    return static_cast<int32_t>(m_results.size());
+}
+
+//
+//
+//
+SearchContextMorton::SearchContextMorton(Point const* points_begin, Point const* points_end) 
+    : m_impl(new SearchContextMorton::Impl(points_begin, points_end))
+{
+}
+
+SearchContextMorton::~SearchContextMorton() 
+{
+}
+
+int32_t SearchContextMorton::search_impl(Rect const& rect, int32_t const count, Point* out_points)
+{
+    return m_impl->search_impl(rect, count, out_points);
+}
@@ -17,9 +17,14 @@
 #include <ppl.h>
 #include "SearchContextImpl.hpp"
 #include "RTree.hpp"
+#include "KthRankGrid.hpp"
+#include "Partition.hpp"
+#include "RankBlockedSlab.hpp"
 #include "iterators.hpp"
 #include "statistics.hpp"
 #include "profile.hpp"
+#include "rank_space.hpp"
+#include "auto_tune.hpp"
 
 #include <iostream>
 
@@ -28,18 +33,125 @@
 //
 class SearchContextRTree::Impl
 {
+    typedef Point point_t;
+    typedef rtree_dynamic_parameters parameters_t;
+    typedef RTree<point_t, parameters_t> rtree_t;
+    typedef Partition<rtree_t> partition_t;
+    typedef rtree_t::Traversal<Rect> traversal_t;
+
 public:
-    Impl(Point const* points_begin, Point const* points_end);
+    typedef rtree_t::Cursor<Rect> cursor_t;
+
+    // Searches interleaved by search_batch_impl().
+    static const std::size_t batch_group_size = 8;
+
+    Impl(Point const* points_begin, Point const* points_end, BuildOptions const& options);
+
+    // Builds from points already in the space of the index and in rank order.
+    Impl(std::vector<point_t>& points, EngineParameters const& parameters, split_options const& split);
+
     ~Impl();
 
+    EngineParameters const& parameters() const { return m_parameters; }
+
     int32_t search_impl(Rect const& rect, int32_t const count, Point* out_points);
+    int32_t search_rank_range_impl(Rect const& rect, int32_t const rank_lo, int32_t const rank_hi, int32_t const count, Point* out_points);
+    int32_t search_filtered_impl(Rect const& rect, id_set const& ids, int32_t const count, Point* out_points);
+    int32_t search_deadline_impl(Rect const& rect, int32_t const count, Point* out_points, int64_t const budget_ns, bool* complete);
+    int32_t search_approximate_impl(Rect const& rect, int32_t const count, Point* out_points, float const recall, float* estimated_recall);
+    int32_t count_impl(Rect const& rect);
+    int32_t search_region_impl(RectUnion const& region, int32_t const max_rank, int32_t const count, Point* out_points);
+    int32_t search_region_impl(ConvexPolygon const& region, int32_t const max_rank, int32_t const count, Point* out_points);
+    int32_t search_batch_impl(Rect const* rects, int32_t const num_rects, int32_t const count, Point* out_points, int32_t* out_counts, std::size_t const group_size = batch_group_size);
+
+    // Adds the R-tree partitions to the cursor.  Returns true if other partitions are left for page_cursor().  If the
+    // region is expected to hold few enough points they are all collected into points instead, in rank order.  The
+    // region and the points are in the space of the index.
+    bool open_cursor(Rect const& region, cursor_t& cursor, std::vector<point_t>& points);
+
+    // The count lowest ranked points from rank_lo inside the region of the partitions that are not R-trees, in rank order.
+    void page_cursor(Rect const& region, int32_t const rank_lo, std::size_t const count, std::vector<point_t>& points);
+
+    // Maps between the coordinates of the caller and the ones the index was built with.
+    Rect to_index(Rect const& rect) const { return m_rank_space.enabled() ? m_rank_space.to_rank_space(rect) : rect; }
+    void from_index(Point* first, Point* last) const
+    {
+        if(!m_rank_space.enabled()) { return; }
+
+        for(; first != last; ++first)
+        {
+            *first = m_rank_space.from_rank_space(*first);
+        }
+    }
 
 private:
-    template<class Reporter>
-    void search_tree(Rect const& region, Reporter& reporter);
+    // One search of a batch, see search_batch_impl().
+    struct BatchSearch
+    {
+        BatchSearch() : reporter(results), rect(-1), partition(0) {}
+
+        Rect region;
+        std::vector<point_t> results;
+        min_constrained_iterator<std::vector<point_t>> reporter;
+        traversal_t traversal;
+        int32_t rect;               // Index of the rect searched, -1 if none.
+        std::size_t partition;      // Next partition to search.
+    };
+
+    void build(std::vector<point_t>& points, split_options const& split);
+    void choose_engines(std::vector<point_t>& points, BuildOptions const& options);
+    std::vector<std::size_t> partition_sizes(std::size_t const num_points) const;
+    EngineParameters tune(std::vector<point_t> const& points, BuildOptions const& options) const;
+
+    bool use_linear_search(Rect const& region, std::size_t& dim, int32_t const count = 0);
+    void slab_fractions(Rect const& region, double fractions[2]);
+    double tree_search_cost(double const fractions[2], int32_t const count) const;
+
+    template<class Region, class Filter>
+    int32_t search_impl(Region const& region, int32_t const count, int32_t const max_rank, Filter const& filter, Point* out_points);
 
-    template<std::size_t I, typename Iter, class Reporter>
-    void search_linear(Iter first, Iter last, Rect const& region, Reporter& reporter);
+    template<class Region, class Filter>
+    int32_t search_index(Region const& region, int32_t const count, int32_t const max_rank, Filter const& filter, Point* out_points);
+
+    template<class Region, class Reporter, class Filter>
+    void search_tree(Region const& region, Reporter& reporter, Filter const& filter);
+
+    bool next_partition(BatchSearch& search);
+
+    // The rank cutoff to start a search with.  Only unfiltered rects are bounded by m_kth_ranks, a filter could reject
+    // the points of the covered cells.
+    template<class Region, class Filter>
+    int32_t initial_max_rank(Region const&, int32_t const, int32_t const max_rank, Filter const&) const { return max_rank; }
+
+    int32_t initial_max_rank(Rect const& region, int32_t const count, int32_t const max_rank, no_filter const&) const
+    {
+        return std::min(max_rank, m_kth_ranks.max_rank(region, count));
+    }
+
+    template<class Region, class Reporter, class Filter>
+    void search_linear(std::size_t const dim, Region const& region, Reporter& reporter, Filter const& filter)
+    {
+        if(dim == 0) { m_slab_x.query(region, reporter, filter); } else { m_slab_y.query(region, reporter, filter); }
+    }
+
+    std::size_t count_linear(std::size_t const dim, Rect const& region) const
+    {
+        return dim == 0 ? m_slab_x.count(region) : m_slab_y.count(region);
+    }
+
+    int32_t report_results(Point* out_points)
+    {
+        return report_results(m_results, out_points);
+    }
+
+    int32_t report_results(std::vector<point_t>& results, Point* out_points)
+    {
+        std::sort(results.begin(), results.end());
+        memcpy(out_points, results.data(), sizeof(Point)*results.size());
+        from_index(out_points, out_points + results.size());
+
+        return static_cast<int32_t>(results.size());
+    }
 
     template<std::size_t I>
     double calculate_contained_percentage(Rect const& region)
@@ -56,22 +168,22 @@ private:
     }
 
 private:
-    typedef Point point_t;
-    typedef RTree<point_t, rtree_parameters<80, 40>> rtree_t;
-
-    static const size_t partition_size = 200000;
-    static const size_t linear_search_threshold = 1000;
+    EngineParameters m_parameters;
 
-    std::vector<rtree_t> m_trees;
+    std::vector<partition_t> m_partitions;
     std::vector<point_t> m_results;
-    std::vector<point_t> m_points_sorted[2];
+    RankBlockedSlab<0> m_slab_x;   // For the linear search of thin rects, see RankBlockedSlab.hpp.
+    RankBlockedSlab<1> m_slab_y;
+    KthRankGrid m_kth_ranks;        // Seeds the rank cutoff of searches, see KthRankGrid.hpp.
 
     statistics::Point m_mean;
     statistics::Point m_stddev;
     Rect mbr;
+
+    RankSpace m_rank_space;
 };
 
-SearchContextRTree::Impl::Impl(Point const* points_begin, Point const* points_end)
+SearchContextRTree::Impl::Impl(Point const* points_begin, Point const* points_end, BuildOptions const& options)
 {
     std::size_t num_points = static_cast<std::size_t>(std::distance(points_begin, points_end));
     if(num_points <= 0) { return; }
@@ -80,13 +192,32 @@ SearchContextRTree::Impl::Impl(Point const* points_begin, Point const* points_en
     points.insert(points.begin(), points_begin, points_end);
     points.erase(std::remove_if(points.begin(), points.end(), [](point_t const& p){ return (abs(p.x) > 1.0e9 || abs(p.y) > 1.0e9); }  ), points.end());
 
+    if(options.rank_space && m_rank_space.build(points.begin(), points.end()))
+    {
+        concurrency::parallel_for_each(points.begin(), points.end(), [this](point_t& p) { p = m_rank_space.to_rank_space(p); });
+    }
+
     concurrency::parallel_sort(points.begin(), points.end());
 
-    m_points_sorted[0] = points;
-    concurrency::parallel_sort(m_points_sorted[0].begin(), m_points_sorted[0].end(), [](point_t const& p1, point_t const& p2) { return p1.x < p2.x; } );
+    m_parameters = options.auto_tune ? tune(points, options) : options.parameters;
+
+    build(points, options.split);
 
-    m_points_sorted[1] = points;
-    concurrency::parallel_sort(m_points_sorted[1].begin(), m_points_sorted[1].end(), [](point_t const& p1, point_t const& p2) { return p1.y < p2.y; } );
+    if(options.hybrid_partitions) { choose_engines(points, options); }
+}
+
+SearchContextRTree::Impl::Impl(std::vector<point_t>& points, EngineParameters const& parameters, split_options const& split)
+    : m_parameters(parameters)
+{
+    if(points.empty()) { return; }
+
+    build(points, split);
+}
+
+void SearchContextRTree::Impl::build(std::vector<point_t>& points, split_options const& split)
+{
+    m_slab_x = RankBlockedSlab<0>(points.begin(), points.end());
+    m_slab_y = RankBlockedSlab<1>(points.begin(), points.end());
 
     initialize(mbr);
 
@@ -101,59 +232,267 @@ SearchContextRTree::Impl::Impl(Point const* points_begin, Point const* points_en
     m_mean = stat_calc.mean;
     m_stddev = stat_calc.calculate_std_dev();
 
-    m_trees.reserve(points.size() / partition_size + 1);
+    m_kth_ranks.build(points.begin(), points.end(), mbr);
+
+    const auto sizes = partition_sizes(points.size());
+    m_partitions.reserve(sizes.size());
+
+    auto startIt = points.begin();
+    for(auto size : sizes)
+    {
+        m_partitions.emplace_back(partition_engine::rtree, startIt, startIt + size, parameters_t(m_parameters.max_leaf_elements, m_parameters.max_elements), split);
+        startIt += size;
+    }
+}
+
+//
+// Each partition is tried with another engine and keeps it if the query mix runs faster, first partition first.  Those
+// of up to Partition::max_flat_size points are tried flat.  The larger ones are tried as a grid if they are hot, reached
+// by at least a quarter of the queries of the mix, and dense, their points spread over at least half of an 8x8 grid
+// over their mbr.  The later partitions are reached by fewer queries, so the grids stop at the first that loses.
+//
+void SearchContextRTree::Impl::choose_engines(std::vector<point_t>& points, BuildOptions const& options)
+{
+    std::vector<Rect> queries;
+    for(auto& q : options.tune_queries) { queries.push_back(to_index(q)); }
+    if(queries.empty()) { queries = tuning::make_queries(tuning::take_sample(points, tuning::sample_size), mbr, points.size()); }
+    if(queries.empty()) { return; }
 
-    auto beginIt = points.begin();
-    auto endIt = points.end();
+    const auto count = std::max(1, options.tune_count);
+    std::vector<Point> out(count);
 
-    auto startIt = beginIt;
-    auto lastIt = startIt + std::min(partition_size, static_cast<size_t>(endIt - startIt));
+    const auto measure = [&]() -> double
+    {
+        return tuning::time_queries(queries, [&](Rect const& q) { search_index(q, count, std::numeric_limits<int32_t>::max(), no_filter(), out.data()); });
+    };
 
-    while(startIt != endIt)
+    // The searches that reach each partition, counted in a pass of its own so the searches themselves write nothing.
+    std::vector<uint32_t> accesses(m_partitions.size(), 0);
+    for(auto& q : queries)
     {
-        m_trees.emplace_back(startIt, lastIt);
+        std::size_t dim = 0;
+        if(!intersects(q, mbr) || use_linear_search(q, dim, count)) { continue; }
 
-        startIt = lastIt != endIt ? lastIt : endIt;
-        lastIt = startIt + std::min(partition_size, static_cast<size_t>(endIt - startIt));
+        reset_results(m_results, count);
+        auto reporter = min_constrained_inserter(m_results, initial_max_rank(q, count, std::numeric_limits<int32_t>::max(), no_filter()));
+
+        for(std::size_t i = 0; i < m_partitions.size(); ++i)
+        {
+            if(m_partitions[i].get_min_rank() > reporter.get_max_rank()) { break; }
+
+            ++accesses[i];
+            m_partitions[i].query(q, reporter, no_filter());
+            if(m_results.size() >= m_results.capacity()) { break; }
+        }
+    }
+
+    const parameters_t parameters(m_parameters.max_leaf_elements, m_parameters.max_elements);
+
+    auto best_time = measure();
+    auto first = points.begin();
+    for(std::size_t i = 0; i < m_partitions.size(); first += m_partitions[i].size(), ++i)
+    {
+        const auto last = first + m_partitions[i].size();
+
+        auto engine = partition_engine::rtree;
+        if(m_partitions[i].size() <= partition_t::max_flat_size)
+        {
+            engine = partition_engine::flat;
+        }
+        else if(accesses[i] * 4 >= queries.size())
+        {
+            Rect bounds;
+            initialize(bounds);
+            std::for_each(first, last, [&](point_t const& p) { extend_bounds(bounds, p); });
+
+            OccupancyGrid occupancy;
+            std::for_each(first, last, [&](point_t const& p) { occupancy.add(bounds, p); });
+            if(occupancy.count() * 2 >= OccupancyGrid::bins * OccupancyGrid::bins) { engine = partition_engine::grid; }
+        }
+
+        if(engine == partition_engine::rtree) { continue; }
+
+        auto tree = m_partitions[i];
+        m_partitions[i] = partition_t(engine, first, last, parameters, options.split);
+
+        // A win must hold on a second run, a single one can be noise.
+        const auto time = measure();
+        if(time * tuning::min_speedup < best_time && measure() * tuning::min_speedup < best_time)
+        {
+            best_time = time;
+            continue;
+        }
+
+        m_partitions[i] = tree;
+        if(engine == partition_engine::grid) { break; }
     }
 }
 
+std::vector<std::size_t> SearchContextRTree::Impl::partition_sizes(std::size_t const num_points) const
+{
+    std::vector<std::size_t> result;
+
+    const auto max_size = std::max<std::size_t>(1, m_parameters.partition_size);
+    auto size = m_parameters.first_partition_size > 0 ? std::min(max_size, m_parameters.first_partition_size) : max_size;
+
+    for(std::size_t remaining = num_points; remaining > 0; )
+    {
+        result.push_back(std::min(size, remaining));
+        remaining -= result.back();
+
+        size = std::min(max_size, size * std::max<std::size_t>(1, m_parameters.partition_growth));
+    }
+
+    return result;
+}
+
 SearchContextRTree::Impl::~Impl()
 {
 }
 
-template<class Reporter>
-void SearchContextRTree::Impl::search_tree(Rect const& region, Reporter& reporter)
+//
+// Tunes one parameter at a time, the tree shape first and then the partitioning, which are mostly independent.  The
+// sample holds a fraction of the points.  The partition size, the linear search threshold and the number of points
+// searched for are scaled by it, so a query searches about as many partitions of the sample as of all of the points.
+//
+EngineParameters SearchContextRTree::Impl::tune(std::vector<point_t> const& points, BuildOptions const& options) const
 {
-    for(auto& tree : m_trees)
+    auto best = options.parameters;
+    if(points.size() < tuning::min_points) { return best; }
+
+    const auto sample = tuning::take_sample(points, tuning::sample_size);
+    const auto scale = static_cast<double>(sample.size()) / points.size();
+
+    Rect bounds;
+    initialize(bounds);
+    for(auto& p : sample) { extend_bounds(bounds, p); }
+
+    std::vector<Rect> queries;
+    for(auto& q : options.tune_queries) { queries.push_back(to_index(q)); }
+    if(queries.empty()) { queries = tuning::make_queries(sample, bounds, points.size()); }
+
+    const auto count = std::max(1, static_cast<int32_t>(options.tune_count * scale + 0.5));
+    std::vector<Point> out(count);
+
+    const auto scaled = [&](EngineParameters parameters) -> EngineParameters
     {
-        tree.query(region, reporter);
-        if(m_results.size() >= m_results.capacity()) { break; }
+        parameters.partition_size = std::max(parameters.max_leaf_elements, static_cast<std::size_t>(parameters.partition_size * scale));
+        if(parameters.first_partition_size > 0)
+        {
+            parameters.first_partition_size = std::max(parameters.max_leaf_elements, static_cast<std::size_t>(parameters.first_partition_size * scale));
+        }
+        parameters.linear_search_threshold = static_cast<std::size_t>(parameters.linear_search_threshold * scale);
+        return parameters;
+    };
+
+    const auto measure = [&](Impl& candidate) -> double
+    {
+        return tuning::time_queries(queries, [&](Rect const& q) { candidate.search_index(q, count, std::numeric_limits<int32_t>::max(), no_filter(), out.data()); });
+    };
+
+    const auto measure_build = [&](EngineParameters const& parameters) -> double
+    {
+        auto copy = sample;
+        Impl candidate(copy, scaled(parameters), options.split);
+        return measure(candidate);
+    };
+
+    const auto caches = tuning::get_cache_sizes();
+
+    auto best_time = measure_build(best);
+    for(auto leaf : tuning::leaf_candidates(caches))
+    {
+        for(auto fanout : tuning::fanout_candidates())
+        {
+            // Nodes above the leaves split down to fanout points, the leaves must hold at least as many.
+            if(leaf < fanout) { continue; }
+
+            auto candidate = best;
+            candidate.max_leaf_elements = leaf;
+            candidate.max_elements = fanout;
+
+            const auto time = measure_build(candidate);
+            if(time * tuning::min_speedup < best_time) { best_time = time; best = candidate; }
+        }
     }
-}
 
-template<std::size_t I, typename Iter, class Reporter>
-void SearchContextRTree::Impl::search_linear(Iter first, Iter last, Rect const& region, Reporter& reporter)
-{
-    auto start = std::lower_bound(first, last, get_dim_coord_lo<I>(region), [](point_t const& p, float v) { return get_dim_coord<I>(p) < v; });
-    for(; start != last && get_dim_coord<I>(*start) <= get_dim_coord_hi<I>(region); ++start)
+    // Geometric partitions grow past any cache size, only where they start is tuned.
+    const bool geometric = options.parameters.first_partition_size > 0;
+    const auto partition_sizes = geometric ? tuning::first_partition_candidates() : tuning::partition_candidates(caches, options.parameters.partition_size, points.size());
+
+    for(auto size : partition_sizes)
     {
-        auto& p = *start;
-        static const std::size_t K = (I + 1) % 2;
-        if(get_dim_coord<K>(p) >= get_dim_coord_lo<K>(region) && get_dim_coord<K>(p) <= get_dim_coord_hi<K>(region))
+        auto candidate = best;
+        (geometric ? candidate.first_partition_size : candidate.partition_size) = size;
+
+        const auto time = measure_build(candidate);
+        if(time * tuning::min_speedup < best_time) { best_time = time; best = candidate; }
+    }
+
+    // The threshold does not change the trees, one build is enough.
+    {
+        auto copy = sample;
+        Impl candidate(copy, scaled(best), options.split);
+
+        for(auto threshold : tuning::threshold_candidates(options.parameters.linear_search_threshold))
         {
-            *reporter = p;
+            auto parameters = best;
+            parameters.linear_search_threshold = threshold;
+            candidate.m_parameters = scaled(parameters);
+
+            const auto time = measure(candidate);
+            if(time * tuning::min_speedup < best_time) { best_time = time; best = parameters; }
         }
     }
+
+    return best;
+}
+
+template<class Region, class Reporter, class Filter>
+void SearchContextRTree::Impl::search_tree(Region const& region, Reporter& reporter, Filter const& filter)
+{
+    for(std::size_t i = 0; i < m_partitions.size(); ++i)
+    {
+        auto& partition = m_partitions[i];
+
+        // Partitions are in rank order, none of the remaining ones can improve the results.
+        if(partition.get_min_rank() > reporter.get_max_rank()) { break; }
+        if(has_expired(filter)) { break; }
+
+        partition.query(region, reporter, filter);
+        if(m_results.size() >= m_results.capacity()) { break; }
+    }
 }
 
 int32_t SearchContextRTree::Impl::search_impl(Rect const& region, int32_t const count, Point* out_points)
 {
-    if(!intersects(region, mbr)) { return 0; }
+    return search_impl(region, count, std::numeric_limits<int32_t>::max(), no_filter(), out_points);
+}
+
+int32_t SearchContextRTree::Impl::search_rank_range_impl(Rect const& region, int32_t const rank_lo, int32_t const rank_hi, int32_t const count, Point* out_points)
+{
+    if(rank_lo >= rank_hi) { return 0; }
 
-    m_results.clear();
-    m_results.reserve(count);
+    return search_impl(region, count, rank_hi - 1, rank_range_filter(rank_lo), out_points);
+}
 
+int32_t SearchContextRTree::Impl::search_filtered_impl(Rect const& region, id_set const& ids, int32_t const count, Point* out_points)
+{
+    return search_impl(region, count, std::numeric_limits<int32_t>::max(), id_filter(ids), out_points);
+}
+
+int32_t SearchContextRTree::Impl::search_deadline_impl(Rect const& region, int32_t const count, Point* out_points, int64_t const budget_ns, bool* complete)
+{
+    const deadline_filter filter(deadline_filter::clock::now() + std::chrono::nanoseconds(budget_ns));
+
+    const auto results = search_impl(region, count, std::numeric_limits<int32_t>::max(), filter, out_points);
+    if(complete) { *complete = !filter.expired; }
+
+    return results;
+}
+
+bool SearchContextRTree::Impl::use_linear_search(Rect const& region, std::size_t& dim, int32_t const count)
+{
     //
     // Attempt to reduce worst case scenarios.
     // 
@@ -166,43 +505,425 @@ int32_t SearchContextRTree::Impl::search_impl(Rect const& region, int32_t const
     // If statistically a significant low amount of points fall within a dimension of the region, then perform linear search 
     // otherwise perform a tree search.
     //
-    auto reporter = min_constrained_inserter(m_results);
+    // Given the count, the linear search is also used when the trees are expected to scan more points than the slab holds.
+    //
+    double fractions[2];
+    slab_fractions(region, fractions);
+    dim = fractions[0] < fractions[1] ? 0 : 1;
+
+    const auto slab_points = fractions[dim] * m_slab_x.size();
+    if(static_cast<std::size_t>(slab_points) <= m_parameters.linear_search_threshold) { return true; }
+
+    return count > 0 && slab_points < tree_search_cost(fractions, count);
+}
+
+// In rank space the number of points in each slab is known exactly.
+void SearchContextRTree::Impl::slab_fractions(Rect const& region, double fractions[2])
+{
+    if(m_rank_space.enabled())
+    {
+        const auto num_points = static_cast<double>(m_rank_space.size());
+        fractions[0] = std::max(0.0f, region.hx - region.lx + 1.0f) / num_points;
+        fractions[1] = std::max(0.0f, region.hy - region.ly + 1.0f) / num_points;
+        return;
+    }
+
+    fractions[0] = calculate_contained_percentage<0>(region);
+    fractions[1] = calculate_contained_percentage<1>(region);
+}
+
+//
+// Expected number of points the trees scan to find count points in a region covering the given fractions of the points
+// along each dimension.  Rank does not depend on position, so each partition holds its share of the points in the
+// region and the search is expected to end in the first partition where the hits add up to count.  The leaves of a
+// partition of s points are taken as a square grid of s / L cells of L points, of which the region overlaps
+// (fx * sqrt(s / L) + 1) * (fy * sqrt(s / L) + 1).
+//
+double SearchContextRTree::Impl::tree_search_cost(double const fractions[2], int32_t const count) const
+{
+    const auto leaf = static_cast<double>(m_parameters.max_leaf_elements);
+
+    double cost = 0.0;
+    double hits = 0.0;
+    for(auto& partition : m_partitions)
+    {
+        const auto size = static_cast<double>(partition.size());
+        const auto side = std::sqrt(size / leaf);
+
+        cost += leaf * std::min(size / leaf, (fractions[0] * side + 1.0) * (fractions[1] * side + 1.0));
+        hits += size * fractions[0] * fractions[1];
+        if(hits >= count) { break; }
+    }
+
+    return cost;
+}
+
+int32_t SearchContextRTree::Impl::count_impl(Rect const& rect)
+{
+    const auto region = to_index(rect);
+    if(!intersects(region, mbr)) { return 0; }
+
+    std::size_t result = 0;
+    std::size_t dim = 0;
+
+    if(!use_linear_search(region, dim))
+    {
+        for(auto& partition : m_partitions)
+        {
+            result += partition.count(region);
+        }
+    }
+    else
+    {
+        result = count_linear(dim, region);
+    }
+
+    return static_cast<int32_t>(result);
+}
+
+int32_t SearchContextRTree::Impl::search_region_impl(RectUnion const& region, int32_t const max_rank, int32_t const count, Point* out_points)
+{
+    return search_impl(region, count, max_rank, no_filter(), out_points);
+}
+
+int32_t SearchContextRTree::Impl::search_region_impl(ConvexPolygon const& region, int32_t const max_rank, int32_t const count, Point* out_points)
+{
+    return search_impl(region, count, max_rank, no_filter(), out_points);
+}
 
-    const double phi[2] = { calculate_contained_percentage<0>(region), calculate_contained_percentage<1>(region) };
-    const auto dim = phi[0] < phi[1] ? 0 : 1;
+template<class Region, class Filter>
+int32_t SearchContextRTree::Impl::search_impl(Region const& region, int32_t const count, int32_t const max_rank, Filter const& filter, Point* out_points)
+{
+    // The results are mapped back by report_results().
+    if(m_rank_space.enabled())
+    {
+        return search_index(to_rank_space(region, m_rank_space), count, max_rank, filter, out_points);
+    }
 
-    auto num_points_probability = static_cast<std::size_t>(phi[dim] * m_points_sorted[dim].size());
+    return search_index(region, count, max_rank, filter, out_points);
+}
 
-    if(num_points_probability > linear_search_threshold)
+template<class Region, class Filter>
+int32_t SearchContextRTree::Impl::search_index(Region const& region, int32_t const count, int32_t const max_rank, Filter const& filter, Point* out_points)
+{
+    if(count <= 0) { return 0; }
+    if(!intersects(region, mbr)) { return 0; }
+
+    reset_results(m_results, count);
+
+    auto reporter = min_constrained_inserter(m_results, initial_max_rank(region, count, max_rank, filter));
+
+    std::size_t dim = 0;
+    if(!use_linear_search(get_bounds(region), dim, count))
     {
-        search_tree(region, reporter);
+        search_tree(region, reporter, filter);
     }
     else
     {
-        auto first = m_points_sorted[dim].begin();
-        auto last = m_points_sorted[dim].end();
+        search_linear(dim, region, reporter, filter);
+    }
+
+    return report_results(out_points);
+}
+
+//
+// Searches the rects a group at a time.  Each search of the group runs one node of an R-tree per turn, see
+// RTree::Traversal, so the cache misses of a search overlap with the turns of the others instead of stalling the whole
+// batch.  The partitions of the other engines and the rects taken by the linear search are searched in a single turn.
+//
+int32_t SearchContextRTree::Impl::search_batch_impl(Rect const* rects, int32_t const num_rects, int32_t const count, Point* out_points, int32_t* out_counts, std::size_t const group_size)
+{
+    if(num_rects <= 0) { return 0; }
+    if(count <= 0)
+    {
+        std::fill(out_counts, out_counts + num_rects, 0);
+        return 0;
+    }
+
+    const auto num_searches = std::max<std::size_t>(1, std::min<std::size_t>(group_size, num_rects));
+    std::unique_ptr<BatchSearch[]> searches(new BatchSearch[num_searches]);
+    for(std::size_t s = 0; s < num_searches; ++s)
+    {
+        // The reporter is bounded by the capacity.
+        searches[s].results.reserve(count);
+    }
+
+    const auto max_rank = std::numeric_limits<int32_t>::max();
+    int32_t results = 0;
+    int32_t next = 0;
+
+    const auto finish = [&](BatchSearch& search)
+    {
+        const auto i = search.rect;
+        out_counts[i] = report_results(search.results, out_points + static_cast<std::size_t>(i) * count);
+        results += out_counts[i];
+        search.rect = -1;
+    };
+
+    // Starts the next rect that needs a tree traversal, the ones that do not are searched on the spot.
+    const auto start = [&](BatchSearch& search)
+    {
+        while(search.rect < 0 && next < num_rects)
+        {
+            const auto i = next++;
+            search.region = to_index(rects[i]);
+
+            std::size_t dim = 0;
+            if(!intersects(search.region, mbr) || use_linear_search(search.region, dim, count))
+            {
+                out_counts[i] = search_index(search.region, count, max_rank, no_filter(), out_points + static_cast<std::size_t>(i) * count);
+                results += out_counts[i];
+                continue;
+            }
+
+            search.rect = i;
+            search.partition = 0;
+            search.reporter.reset(initial_max_rank(search.region, count, max_rank, no_filter()));
+            if(!next_partition(search)) { finish(search); }
+        }
+    };
+
+    for(std::size_t s = 0; s < num_searches; ++s) { start(searches[s]); }
+
+    for(bool active = true; active; )
+    {
+        active = false;
+        for(std::size_t s = 0; s < num_searches; ++s)
+        {
+            auto& search = searches[s];
+            if(search.rect < 0) { continue; }
+
+            active = true;
+            if(search.traversal.step(search.reporter, no_filter()) || next_partition(search)) { continue; }
+
+            finish(search);
+            start(search);
+        }
+    }
+
+    return results;
+}
+
+// Searches the partitions of a batch search in order up to the next R-tree to traverse, with the same cutoffs as
+// search_tree().  Returns false once the search is done.
+bool SearchContextRTree::Impl::next_partition(BatchSearch& search)
+{
+    while(search.partition < m_partitions.size())
+    {
+        auto& partition = m_partitions[search.partition];
+
+        if(partition.get_min_rank() > search.reporter.get_max_rank()) { return false; }
+        if(search.results.size() >= search.results.capacity()) { return false; }
 
-        if(dim == 0)
+        ++search.partition;
+        if(partition.tree() == nullptr)
+        {
+            partition.query(search.region, search.reporter, no_filter());
+        }
+        else if(search.traversal.start(*partition.tree(), search.region, no_filter()))
         {
-            search_linear<0>(first, last, region, reporter);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int32_t SearchContextRTree::Impl::search_approximate_impl(Rect const& rect, int32_t const count, Point* out_points, float const recall, float* estimated_recall)
+{
+    if(estimated_recall) { *estimated_recall = 1.0f; }
+
+    const auto region = to_index(rect);
+
+    std::size_t dim = 0;
+    if(count <= 0 || !intersects(region, mbr) || use_linear_search(region, dim, count))
+    {
+        // Regions expected to hold few points are cheap to search exactly.
+        return search_index(region, count, std::numeric_limits<int32_t>::max(), no_filter(), out_points);
+    }
+
+    reset_results(m_results, count);
+
+    auto reporter = min_constrained_inserter(m_results, initial_max_rank(region, count, std::numeric_limits<int32_t>::max(), no_filter()));
+
+    //
+    // The partitions are in rank order.  Rank does not depend on position, so each partition holds its share of the
+    // points in the region, in proportion to its size.  Skipping the remaining partitions only loses points while the
+    // results are not full.  The recall is estimated as the larger of the fraction of the results found and the fraction
+    // of the points searched.
+    //
+    const auto num_partitions = m_partitions.size();
+    const auto num_points = static_cast<float>(m_slab_x.size());
+    std::size_t searched = 0;
+    std::size_t searched_points = 0;
+    float estimate = 0.0f;
+
+    for(; searched < num_partitions; ++searched)
+    {
+        auto& partition = m_partitions[searched];
+
+        if(partition.get_min_rank() > reporter.get_max_rank()) { break; }
+        if(m_results.size() >= m_results.capacity()) { break; }
+
+        estimate = std::max(static_cast<float>(m_results.size()) / count, searched_points / num_points);
+        if(searched > 0 && estimate >= recall) { break; }
+
+        partition.query(region, reporter, no_filter());
+        searched_points += partition.size();
+    }
+
+    // Ending on a rank breakout or full results is exact, the remaining partitions could not improve them.
+    const bool exact = searched == num_partitions || m_results.size() >= m_results.capacity() || m_partitions[searched].get_min_rank() > reporter.get_max_rank();
+    if(estimated_recall && !exact) { *estimated_recall = estimate; }
+
+    return report_results(out_points);
+}
+
+//
+//
+//
+bool SearchContextRTree::Impl::open_cursor(Rect const& region, cursor_t& cursor, std::vector<point_t>& points)
+{
+    if(!intersects(region, mbr)) { return false; }
+
+    std::size_t dim = 0;
+    if(use_linear_search(region, dim))
+    {
+        auto reporter = unconstrained_iterator<std::vector<point_t>>(points);
+        search_linear(dim, region, reporter, no_filter());
+
+        std::sort(points.begin(), points.end());
+        return false;
+    }
+
+    bool paged = false;
+    for(auto& partition : m_partitions)
+    {
+        if(!partition.open(cursor)) { paged = true; }
+    }
+
+    return paged;
+}
+
+void SearchContextRTree::Impl::page_cursor(Rect const& region, int32_t const rank_lo, std::size_t const count, std::vector<point_t>& points)
+{
+    reset_results(points, count);
+
+    auto reporter = min_constrained_inserter(points);
+    const rank_range_filter filter(rank_lo);
+
+    for(auto& partition : m_partitions)
+    {
+        if(partition.get_min_rank() > reporter.get_max_rank()) { break; }
+
+        if(partition.engine() != partition_engine::rtree)
+        {
+            partition.query(region, reporter, filter);
+        }
+    }
+
+    std::sort(points.begin(), points.end());
+}
+
+//
+//
+//
+class SearchContextRTree::Cursor::Impl
+{
+public:
+    Impl(std::shared_ptr<SearchContextRTree> const& context, Rect const& region);
+
+    int32_t next(int32_t const count, Point* out_points);
+
+private:
+    // Each page searches the partitions that are not R-trees again, so pages are not made smaller than this.
+    static const std::size_t min_page_size = 256;
+
+    void next_page(std::size_t const page_size);
+
+private:
+    std::shared_ptr<SearchContextRTree> m_context;
+    Rect m_region;
+    SearchContextRTree::Impl::cursor_t m_cursor;
+
+    // The points of the partitions that are not R-trees, a page at a time, merged with the cursor in rank order.  For
+    // regions expected to hold few points, all of the points of the region in a single page.
+    std::vector<Point> m_points;
+    std::size_t m_next;
+    bool m_paged;       // More pages may follow m_points.
+};
+
+SearchContextRTree::Cursor::Impl::Impl(std::shared_ptr<SearchContextRTree> const& context, Rect const& region)
+    : m_context(context)
+    , m_region(context->m_impl->to_index(region))
+    , m_cursor(m_region)
+    , m_next(0)
+{
+    m_paged = context->m_impl->open_cursor(m_region, m_cursor, m_points);
+}
+
+void SearchContextRTree::Cursor::Impl::next_page(std::size_t const page_size)
+{
+    const auto rank_lo = m_points.empty() ? std::numeric_limits<int32_t>::lowest() : m_points.back().rank + 1;
+
+    m_context->m_impl->page_cursor(m_region, rank_lo, page_size, m_points);
+    m_next = 0;
+    m_paged = m_points.size() == page_size;
+}
+
+int32_t SearchContextRTree::Cursor::Impl::next(int32_t const count, Point* out_points)
+{
+    if(count <= 0) { return 0; }
+
+    std::size_t n = 0;
+    while(n < static_cast<std::size_t>(count))
+    {
+        if(m_next == m_points.size() && m_paged)
+        {
+            next_page(std::max(count - n, std::size_t(min_page_size)));
+        }
+
+        if(m_next == m_points.size())
+        {
+            n += m_cursor.next(count - n, out_points + n);
+            break;
+        }
+
+        int32_t rank = 0;
+        if(m_cursor.peek_rank(rank) && rank < m_points[m_next].rank)
+        {
+            n += m_cursor.next(1, out_points + n);
         }
         else
         {
-            search_linear<1>(first, last, region, reporter);
+            out_points[n++] = m_points[m_next++];
         }
     }
 
-    std::sort(m_results.begin(), m_results.end());
-    memcpy(out_points, m_results.data(), sizeof(Point)*m_results.size());
+    m_context->m_impl->from_index(out_points, out_points + n);
 
-    return static_cast<int32_t>(m_results.size());
+    return static_cast<int32_t>(n);
+}
+
+SearchContextRTree::Cursor::Cursor(std::shared_ptr<SearchContextRTree> const& context, Rect const& rect)
+    : m_impl(new SearchContextRTree::Cursor::Impl(context, rect))
+{
+}
+
+SearchContextRTree::Cursor::~Cursor()
+{
+}
+
+int32_t SearchContextRTree::Cursor::next(int32_t const count, Point* out_points)
+{
+    return m_impl->next(count, out_points);
 }
 
 //
 //
 //
-SearchContextRTree::SearchContextRTree(Point const* points_begin, Point const* points_end) 
-    : m_impl(new SearchContextRTree::Impl(points_begin, points_end))
+SearchContextRTree::SearchContextRTree(Point const* points_begin, Point const* points_end, BuildOptions const& options) 
+    : m_impl(new SearchContextRTree::Impl(points_begin, points_end, options))
 {
 }
 
@@ -214,3 +935,48 @@ int32_t SearchContextRTree::search_impl(Rect const& rect, int32_t const count, P
 {
     return m_impl->search_impl(rect, count, out_points);
 }
+
+int32_t SearchContextRTree::search_rank_range_impl(Rect const& rect, int32_t const rank_lo, int32_t const rank_hi, int32_t const count, Point* out_points)
+{
+    return m_impl->search_rank_range_impl(rect, rank_lo, rank_hi, count, out_points);
+}
+
+int32_t SearchContextRTree::search_filtered_impl(Rect const& rect, id_set const& ids, int32_t const count, Point* out_points)
+{
+    return m_impl->search_filtered_impl(rect, ids, count, out_points);
+}
+
+int32_t SearchContextRTree::search_deadline_impl(Rect const& rect, int32_t const count, Point* out_points, int64_t const budget_ns, bool* complete)
+{
+    return m_impl->search_deadline_impl(rect, count, out_points, budget_ns, complete);
+}
+
+int32_t SearchContextRTree::search_approximate_impl(Rect const& rect, int32_t const count, Point* out_points, float const recall, float* estimated_recall)
+{
+    return m_impl->search_approximate_impl(rect, count, out_points, recall, estimated_recall);
+}
+
+int32_t SearchContextRTree::count_impl(Rect const& rect)
+{
+    return m_impl->count_impl(rect);
+}
+
+EngineParameters const& SearchContextRTree::parameters() const
+{
+    return m_impl->parameters();
+}
+
+int32_t SearchContextRTree::search_region_impl(RectUnion const& region, int32_t const max_rank, int32_t const count, Point* out_points)
+{
+    return m_impl->search_region_impl(region, max_rank, count, out_points);
+}
+
+int32_t SearchContextRTree::search_region_impl(ConvexPolygon const& region, int32_t const max_rank, int32_t const count, Point* out_points)
+{
+    return m_impl->search_region_impl(region, max_rank, count, out_points);
+}
+
+int32_t SearchContextRTree::search_batch_impl(Rect const* rects, int32_t const num_rects, int32_t const count, Point* out_points, int32_t* out_counts)
+{
+    return m_impl->search_batch_impl(rects, num_rects, count, out_points, out_counts);
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SearchContextImpl.hpp"
+#include "RangeTree.hpp"
+#include "iterators.hpp"
+
+//
+//
+//
+class SearchContextRangeTree::Impl
+{
+public:
+    Impl(Point const* points_begin, Point const* points_end);
+    ~Impl();
+
+    int32_t search_impl(Rect const& rect, int32_t const count, Point* out_points);
+
+private:
+    RangeTree m_tree;
+    std::vector<Point> m_results;
+};
+
+SearchContextRangeTree::Impl::Impl(Point const* points_begin, Point const* points_end)
+{
+    std::vector<Point> points;
+
+    if(points_begin < points_end)
+    {
+        points.insert(points.begin(), points_begin, points_end);
+        points.erase(std::remove_if(points.begin(), points.end(), [](Point const& p){ return (abs(p.x) > 1.0e9 || abs(p.y) > 1.0e9); }  ), points.end());
+    }
+
+    m_tree = RangeTree(points.begin(), points.end());
+}
+
+SearchContextRangeTree::Impl::~Impl()
+{
+}
+
+int32_t SearchContextRangeTree::Impl::search_impl(Rect const& rect, int32_t const count, Point* out_points)
+{
+    if(count <= 0) { return 0; }
+
+    reset_results(m_results, count);
+
+    auto reporter = min_constrained_inserter(m_results);
+    m_tree.query(rect, reporter);
+
+    std::sort(m_results.begin(), m_results.end());
+    memcpy(out_points, m_results.data(), sizeof(Point)*m_results.size());
+
+    return static_cast<int32_t>(m_results.size());
+}
+
+//
+//
+//
+SearchContextRangeTree::SearchContextRangeTree(Point const* points_begin, Point const* points_end) 
+    : m_impl(new SearchContextRangeTree::Impl(points_begin, points_end))
+{
+}
+
+SearchContextRangeTree::~SearchContextRangeTree() 
+{
+}
+
+int32_t SearchContextRangeTree::search_impl(Rect const& rect, int32_t const count, Point* out_points)
+{
+    return m_impl->search_impl(rect, count, out_points);
+}
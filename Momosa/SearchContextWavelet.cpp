@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ppl.h>
+#include "SearchContextImpl.hpp"
+#include "WaveletTree.hpp"
+#include "iterators.hpp"
+
+//
+//
+//
+class SearchContextWavelet::Impl
+{
+public:
+    Impl(Point const* points_begin, Point const* points_end);
+    ~Impl();
+
+    int32_t search_impl(Rect const& rect, int32_t const count, Point* out_points);
+    std::size_t size_in_bytes() const;
+
+private:
+    // The first of the doubling rank partitions, see doubling_rank_partitions().  A tree reports every point of the
+    // rect, the doubling keeps that to about twice the points needed.
+    static const std::size_t first_partition_size = 256;
+
+    std::vector<WaveletTree> m_trees;
+    std::vector<Point> m_results;
+};
+
+SearchContextWavelet::Impl::Impl(Point const* points_begin, Point const* points_end)
+{
+    std::vector<Point> points;
+    std::vector<std::size_t> starts;
+    doubling_rank_partitions(points_begin, points_end, first_partition_size, points, starts);
+
+    m_trees.resize(starts.size() - 1);
+    concurrency::parallel_for(std::size_t(0), m_trees.size(), [&](std::size_t i)
+    {
+        m_trees[i] = WaveletTree(points.begin() + starts[i], points.begin() + starts[i + 1]);
+    });
+}
+
+SearchContextWavelet::Impl::~Impl()
+{
+}
+
+int32_t SearchContextWavelet::Impl::search_impl(Rect const& rect, int32_t const count, Point* out_points)
+{
+    if(count <= 0) { return 0; }
+
+    reset_results(m_results, count);
+
+    auto reporter = min_constrained_inserter(m_results);
+    for(auto& tree : m_trees)
+    {
+        // Partitions are in rank order, none of the remaining ones can improve the results.
+        if(m_results.size() >= m_results.capacity()) { break; }
+
+        tree.query(rect, reporter);
+    }
+
+    std::sort(m_results.begin(), m_results.end());
+    memcpy(out_points, m_results.data(), sizeof(Point)*m_results.size());
+
+    return static_cast<int32_t>(m_results.size());
+}
+
+std::size_t SearchContextWavelet::Impl::size_in_bytes() const
+{
+    std::size_t result = 0;
+    for(auto& tree : m_trees)
+    {
+        result += tree.size_in_bytes();
+    }
+
+    return result;
+}
+
+//
+//
+//
+SearchContextWavelet::SearchContextWavelet(Point const* points_begin, Point const* points_end) 
+    : m_impl(new SearchContextWavelet::Impl(points_begin, points_end))
+{
+}
+
+SearchContextWavelet::~SearchContextWavelet() 
+{
+}
+
+int32_t SearchContextWavelet::search_impl(Rect const& rect, int32_t const count, Point* out_points)
+{
+    return m_impl->search_impl(rect, count, out_points);
+}
+
+std::size_t SearchContextWavelet::size_in_bytes() const
+{
+    return m_impl->size_in_bytes();
+}
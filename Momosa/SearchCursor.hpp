@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "SearchContext.hpp"
+
+class SearchCursor
+{
+public:
+    SearchCursor(SearchContext& context, Rect const& rect)
+        : m_cursor(context.snapshot(), rect)
+    {
+    }
+
+    int32_t next(int32_t const count, Point* out_points)
+    {
+        return m_cursor.next(count, out_points);
+    }
+
+private:
+    SearchContextRTree::Cursor m_cursor;
+};
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "SearchContext.hpp"
+
+//
+// Follows a client's viewport as it pans and zooms.  Only the parts of the new rect that were outside of the previous
+// one are searched, the rest of the results come from the previous result set.
+//
+// The session keeps the best points of the rect, a quarter more than were asked for, so the results that leave the
+// rect as it pans are covered by the extra ones.  Every point of the previous rect up to the rank of the last one kept
+// is kept, so the best points of the new rect up to that rank are the best of:
+//   - the kept points still inside the rect,
+//   - the best points in the area that entered the rect, up to the last one found if the search was cut short.
+// If that leaves fewer points than were asked for the rect is searched again from scratch.
+//
+class TrackSession
+{
+public:
+    explicit TrackSession(SearchContext& context)
+        : m_context(context)
+        , m_complete(false)
+    {
+    }
+
+    int32_t update(Rect const& rect, int32_t const count, Point* out_points)
+    {
+        if(count <= 0) { return 0; }
+
+        auto impl = m_context.snapshot();
+        const auto depth = static_cast<int32_t>(std::min<int64_t>(std::numeric_limits<int32_t>::max(), int64_t(count) + std::max(1, count / 4)));
+
+        // Start over if this is the first rect, the index was rebuilt or the rects don't overlap.  A rect that held all
+        // of its points is sparse, finding the entered area costs as much as searching the whole rect again.
+        if(m_impl.lock() != impl || !intersects(rect, m_rect) || m_complete)
+        {
+            return restart(impl, rect, count, depth, out_points);
+        }
+
+        // The points of the previous rect up to this rank are all kept.
+        auto max_rank = m_results.back().rank;
+
+        m_candidates.clear();
+        for(auto& p : m_results)
+        {
+            if(contains(rect, p)) { m_candidates.push_back(p); }
+        }
+
+        m_entered.clear();
+        get_entered_area(rect, m_rect, m_entered);
+
+        if(!m_entered.empty())
+        {
+            const auto retained = m_candidates.size();
+            append(m_candidates, depth, [&](Point* out) { return impl->search_region(RectUnion(m_entered.data(), m_entered.data() + m_entered.size()), max_rank, depth, out); });
+
+            // A full search leaves points of the entered area ranked after the last one found.
+            if(m_candidates.size() - retained == static_cast<std::size_t>(depth))
+            {
+                max_rank = m_candidates.back().rank;
+            }
+        }
+
+        std::sort(m_candidates.begin(), m_candidates.end());
+        m_candidates.erase(std::upper_bound(m_candidates.begin(), m_candidates.end(), max_rank, [](int32_t const rank, Point const& p) { return rank < p.rank; }), m_candidates.end());
+
+        if(m_candidates.size() > static_cast<std::size_t>(depth)) { m_candidates.resize(depth); }
+
+        if(m_candidates.size() < static_cast<std::size_t>(count))
+        {
+            return restart(impl, rect, count, depth, out_points);
+        }
+
+        m_results.swap(m_candidates);
+        m_rect = rect;
+        m_complete = false;
+
+        return report(count, out_points);
+    }
+
+private:
+    int32_t restart(std::shared_ptr<SearchContextRTree> const& impl, Rect const& rect, int32_t const count, int32_t const depth, Point* out_points)
+    {
+        m_results.resize(depth);
+        m_results.resize(impl->search(rect, depth, m_results.data()));
+
+        m_impl = impl;
+        m_rect = rect;
+        m_complete = m_results.size() < static_cast<std::size_t>(depth);
+
+        return report(count, out_points);
+    }
+
+    int32_t report(int32_t const count, Point* out_points) const
+    {
+        const auto size = std::min(m_results.size(), static_cast<std::size_t>(count));
+        std::copy(m_results.begin(), m_results.begin() + size, out_points);
+        return static_cast<int32_t>(size);
+    }
+
+    template<typename Search>
+    static void append(std::vector<Point>& points, int32_t const count, Search search)
+    {
+        const auto size = points.size();
+        points.resize(size + count);
+        points.resize(size + search(points.data() + size));
+    }
+
+    // Splits the part of rect outside of previous into disjoint rects.  Left and right strips span the height of rect,
+    // the bottom and top strips only the width of the overlap.
+    static void get_entered_area(Rect const& rect, Rect const& previous, std::vector<Rect>& entered)
+    {
+        const auto lo = -std::numeric_limits<float>::infinity();
+        const auto hi = std::numeric_limits<float>::infinity();
+
+        if(rect.lx < previous.lx)
+        {
+            Rect r = { rect.lx, rect.ly, std::nextafter(previous.lx, lo), rect.hy };
+            entered.push_back(r);
+        }
+
+        if(rect.hx > previous.hx)
+        {
+            Rect r = { std::nextafter(previous.hx, hi), rect.ly, rect.hx, rect.hy };
+            entered.push_back(r);
+        }
+
+        const auto lx = std::max(rect.lx, previous.lx);
+        const auto hx = std::min(rect.hx, previous.hx);
+
+        if(rect.ly < previous.ly)
+        {
+            Rect r = { lx, rect.ly, hx, std::nextafter(previous.ly, lo) };
+            entered.push_back(r);
+        }
+
+        if(rect.hy > previous.hy)
+        {
+            Rect r = { lx, std::nextafter(previous.hy, hi), hx, rect.hy };
+            entered.push_back(r);
+        }
+    }
+
+private:
+    SearchContext& m_context;
+    std::weak_ptr<SearchContextRTree> m_impl;
+
+    Rect m_rect;
+    bool m_complete;        // m_results holds every point of m_rect.
+
+    std::vector<Point> m_results;
+    std::vector<Point> m_candidates;
+    std::vector<Rect> m_entered;
+};
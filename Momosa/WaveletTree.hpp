@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <assert.h>
+
+#include <intrin.h>
+#pragma intrinsic(__popcnt64)
+
+#include "point_utils.hpp"
+
+// Bit vector with constant time rank.  A running count every 256 bits costs an eighth of a bit per bit.
+class RankBitVector
+{
+public:
+    RankBitVector() {}
+
+    explicit RankBitVector(std::size_t num_bits)
+        : m_words(num_bits / 64 + 1, 0)
+        , m_counts(num_bits / 256 + 1, 0)
+    {
+    }
+
+    void set(uint32_t i) { m_words[i >> 6] |= uint64_t(1) << (i & 63); }
+    bool get(uint32_t i) const { return (m_words[i >> 6] >> (i & 63)) & 1; }
+
+    // Must be called after the last set().
+    void build_counts()
+    {
+        uint32_t count = 0;
+        for(std::size_t w = 0; w < m_words.size(); ++w)
+        {
+            if((w & 3) == 0) { m_counts[w >> 2] = count; }
+            count += static_cast<uint32_t>(__popcnt64(m_words[w]));
+        }
+    }
+
+    // Number of set bits before i.
+    uint32_t rank1(uint32_t i) const
+    {
+        const auto w = i >> 6;
+
+        auto result = m_counts[i >> 8];
+        for(auto j = w & ~3u; j < w; ++j)
+        {
+            result += static_cast<uint32_t>(__popcnt64(m_words[j]));
+        }
+
+        return result + static_cast<uint32_t>(__popcnt64(m_words[w] & ((uint64_t(1) << (i & 63)) - 1)));
+    }
+
+    uint32_t rank0(uint32_t i) const { return i - rank1(i); }
+
+    std::size_t size_in_bytes() const { return m_words.size() * sizeof(uint64_t) + m_counts.size() * sizeof(uint32_t); }
+
+private:
+    std::vector<uint64_t> m_words;
+    std::vector<uint32_t> m_counts;
+};
+
+//
+// Compact index of a set of points.  The points are ordered by x and a levelwise wavelet tree is built over their y
+// coordinates, mapped to order preserving 32 bit keys so no sorted copy of y is needed to translate the query.  Level i
+// stably partitions each node by bit 31 - i of the key, so the last level is in y order and a leaf reached with a non
+// empty range is a contiguous run of points.  Only that last order of the points is kept along with the x coordinates
+// to find the x range, about 17 bytes per point plus 36 bits per point for the tree.
+//
+// Reporting costs O(32) per distinct y in the rect.  There is no rank order inside a tree, callers keep the trees
+// small where ranks are low so little is reported beyond the top k, see SearchContextWavelet.
+//
+class WaveletTree
+{
+public:
+    static const uint32_t num_levels = 32;
+
+    WaveletTree() {}
+
+    template <typename Iterator>
+    WaveletTree(Iterator points_begin, Iterator points_end)
+    {
+        build(points_begin, points_end);
+    }
+
+    template<typename OutIter>
+    void query(Rect const& region, OutIter& out_it)
+    {
+        if(m_points.empty()) { return; }
+        if(!(region.ly <= region.hy)) { return; }
+
+        const auto s = static_cast<uint32_t>(std::lower_bound(m_xs.begin(), m_xs.end(), region.lx) - m_xs.begin());
+        const auto e = static_cast<uint32_t>(std::upper_bound(m_xs.begin(), m_xs.end(), region.hx) - m_xs.begin());
+        if(s >= e) { return; }
+
+        const auto key_lo = to_key(region.ly);
+        const auto key_hi = to_key(region.hy);
+
+        m_tasks.clear();
+        m_tasks.push_back(Task(0, 0, static_cast<uint32_t>(m_points.size()), s, e, 0));
+
+        while(!m_tasks.empty())
+        {
+            const auto task = m_tasks.back();
+            m_tasks.pop_back();
+
+            // The keys of the node are [task.key, task.key + span - 1].
+            const auto span = uint64_t(1) << (num_levels - task.level);
+            if(task.key > key_hi || task.key + span - 1 < key_lo) { continue; }
+
+            if(task.level == num_levels)
+            {
+                for(auto i = task.s; i < task.e; ++i)
+                {
+                    *out_it = m_points[i];
+                }
+                continue;
+            }
+
+            auto const& bits = m_levels[task.level];
+            const auto zeros_nb = bits.rank0(task.nb);
+            const auto zeros_ne = bits.rank0(task.ne);
+            const auto zeros_s = bits.rank0(task.s);
+            const auto zeros_e = bits.rank0(task.e);
+
+            const auto middle = task.nb + (zeros_ne - zeros_nb);
+            const auto level = task.level + 1;
+
+            const auto left_s = task.nb + (zeros_s - zeros_nb);
+            const auto left_e = task.nb + (zeros_e - zeros_nb);
+            if(left_s < left_e)
+            {
+                m_tasks.push_back(Task(level, task.nb, middle, left_s, left_e, task.key));
+            }
+
+            const auto right_s = middle + (task.s - task.nb) - (zeros_s - zeros_nb);
+            const auto right_e = middle + (task.e - task.nb) - (zeros_e - zeros_nb);
+            if(right_s < right_e)
+            {
+                m_tasks.push_back(Task(level, middle, task.ne, right_s, right_e, task.key + static_cast<uint32_t>(span >> 1)));
+            }
+        }
+    }
+
+    int32_t get_min_rank() const { return m_min_rank; }
+
+    std::size_t size_in_bytes() const
+    {
+        std::size_t result = m_points.size() * sizeof(Point) + m_xs.size() * sizeof(float);
+        for(auto& level : m_levels)
+        {
+            result += level.size_in_bytes();
+        }
+
+        return result;
+    }
+
+private:
+    struct Task
+    {
+        Task(uint32_t level_, uint32_t nb_, uint32_t ne_, uint32_t s_, uint32_t e_, uint32_t key_)
+            : level(level_), nb(nb_), ne(ne_), s(s_), e(e_), key(key_) {}
+
+        uint32_t level;
+        uint32_t nb;    // Node range at this level.
+        uint32_t ne;
+        uint32_t s;     // Part of the node range inside the x range.
+        uint32_t e;
+        uint32_t key;   // Smallest key of the node.
+    };
+
+    // Maps a float to an unsigned key with the same order.
+    static uint32_t to_key(float v)
+    {
+        v += 0.0f; // -0 to 0
+
+        uint32_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+
+        return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+    }
+
+    template <typename Iterator>
+    void build(Iterator points_begin, Iterator points_end)
+    {
+        std::vector<Point> points(points_begin, points_end);
+        if(points.empty()) { return; }
+
+        std::sort(points.begin(), points.end(), [](Point const& p1, Point const& p2) { return p1.x < p2.x; });
+
+        const auto num_points = static_cast<uint32_t>(points.size());
+
+        m_xs.resize(num_points);
+        m_min_rank = std::numeric_limits<int32_t>::max();
+        for(uint32_t i = 0; i < num_points; ++i)
+        {
+            m_xs[i] = points[i].x;
+            m_min_rank = std::min(m_min_rank, points[i].rank);
+        }
+
+        std::vector<uint32_t> keys(num_points);
+        std::transform(points.begin(), points.end(), keys.begin(), [](Point const& p) { return to_key(p.y); });
+
+        std::vector<Point> next_points(num_points);
+        std::vector<uint32_t> next_keys(num_points);
+
+        m_levels.reserve(num_levels);
+        for(uint32_t level = 0; level < num_levels; ++level)
+        {
+            m_levels.emplace_back(num_points);
+            auto& bits = m_levels.back();
+
+            const auto bit = num_levels - 1 - level;
+
+            // Stable partition of each node by the bit.  The nodes of the level are the runs of equal higher bits.
+            uint32_t nb = 0;
+            while(nb < num_points)
+            {
+                auto ne = nb + 1;
+                while(ne < num_points && (keys[ne] >> bit >> 1) == (keys[nb] >> bit >> 1)) { ++ne; }
+
+                auto out = nb;
+                for(auto i = nb; i < ne; ++i)
+                {
+                    if(((keys[i] >> bit) & 1) == 0) { next_points[out] = points[i]; next_keys[out] = keys[i]; ++out; }
+                }
+                for(auto i = nb; i < ne; ++i)
+                {
+                    if(((keys[i] >> bit) & 1) != 0) { bits.set(i); next_points[out] = points[i]; next_keys[out] = keys[i]; ++out; }
+                }
+
+                nb = ne;
+            }
+
+            bits.build_counts();
+
+            points.swap(next_points);
+            keys.swap(next_keys);
+        }
+
+        m_points.swap(points);
+    }
+
+private:
+    std::vector<Point> m_points;    // In the order of the last level, by y.
+    std::vector<float> m_xs;        // x of the points in the order of the first level.
+    std::vector<RankBitVector> m_levels;
+    std::vector<Task> m_tasks;
+    int32_t m_min_rank;
+};
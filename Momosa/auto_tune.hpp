@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <windows.h>
+
+#include "point_utils.hpp"
+#include "profile.hpp"
+
+//
+// Helpers to choose the engine parameters at build time.  The candidates follow from the cache sizes of the machine,
+// leaves that fit in the L1 cache and partitions whose points fit in a few times the L2 cache.  Each candidate is built
+// on a sample of the points and timed on a query mix, the fastest is kept.
+//
+namespace tuning {
+
+// Points in the sample the candidates are built on.
+static const std::size_t sample_size = std::size_t(1) << 18;
+
+// Below this many points the defaults are used, there is too little to measure.
+static const std::size_t min_points = 50000;
+
+// Queries in the synthetic mix.
+static const std::size_t num_queries = 1024;
+
+// A candidate replaces the best one so far only if it is faster by this factor, timings of a few milliseconds are noisy.
+static const double min_speedup = 1.1;
+
+struct cache_sizes
+{
+    cache_sizes() : l1(32 * 1024), l2(256 * 1024) {}
+
+    std::size_t l1;     // Data cache of one core.
+    std::size_t l2;
+};
+
+inline cache_sizes get_cache_sizes()
+{
+    cache_sizes result;
+
+    DWORD length = 0;
+    GetLogicalProcessorInformation(nullptr, &length);
+    if(length == 0) { return result; }
+
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if(!GetLogicalProcessorInformation(info.data(), &length)) { return result; }
+
+    for(auto const& i : info)
+    {
+        if(i.Relationship != RelationCache) { continue; }
+
+        if(i.Cache.Level == 1 && i.Cache.Type == CacheData) { result.l1 = i.Cache.Size; }
+        if(i.Cache.Level == 2) { result.l2 = i.Cache.Size; }
+    }
+
+    return result;
+}
+
+// Leaf sizes whose points fit in half of the L1 cache.
+inline std::vector<std::size_t> leaf_candidates(cache_sizes const& caches)
+{
+    static const std::size_t sizes[] = { 32, 64, 128, 256 };
+
+    std::vector<std::size_t> result;
+    for(auto size : sizes)
+    {
+        if(result.empty() || size * sizeof(Point) <= caches.l1 / 2) { result.push_back(size); }
+    }
+
+    return result;
+}
+
+inline std::vector<std::size_t> fanout_candidates()
+{
+    static const std::size_t sizes[] = { 16, 32, 64 };
+
+    return std::vector<std::size_t>(std::begin(sizes), std::end(sizes));
+}
+
+// Partitions of 1 to 16 times the points that fit in the L2 cache, the default among them.  At least four partitions are
+// kept, with fewer the search can hardly stop early on rank.
+inline std::vector<std::size_t> partition_candidates(cache_sizes const& caches, std::size_t default_size, std::size_t num_points)
+{
+    std::vector<std::size_t> result;
+
+    const auto l2_points = caches.l2 / sizeof(Point);
+    for(std::size_t factor = 1; factor <= 16; factor *= 2)
+    {
+        if(l2_points * factor * 4 <= num_points) { result.push_back(l2_points * factor); }
+    }
+
+    result.push_back(default_size);
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+
+    return result;
+}
+
+inline std::vector<std::size_t> first_partition_candidates()
+{
+    static const std::size_t sizes[] = { 1024, 4096, 16384 };
+
+    return std::vector<std::size_t>(std::begin(sizes), std::end(sizes));
+}
+
+inline std::vector<std::size_t> threshold_candidates(std::size_t default_threshold)
+{
+    std::vector<std::size_t> result;
+    for(std::size_t factor = 1; factor <= 16; factor *= 4)
+    {
+        result.push_back(default_threshold * factor / 4);
+    }
+
+    return result;
+}
+
+// Every stride'th point, the sample keeps the order of the points.
+template<typename Value>
+std::vector<Value> take_sample(std::vector<Value> const& points, std::size_t const size)
+{
+    const auto stride = std::max<std::size_t>(1, points.size() / size);
+
+    std::vector<Value> result;
+    result.reserve(points.size() / stride + 1);
+    for(std::size_t i = 0; i < points.size(); i += stride)
+    {
+        result.push_back(points[i]);
+    }
+
+    return result;
+}
+
+//
+// Rects centered on points of the sample, so they follow the distribution of the data.  The area is log uniform for
+// 1 to 100000 points of total_points if they were spread evenly over bounds, the aspect log uniform from 1:16 to 16:1.
+//
+template<typename Value>
+std::vector<Rect> make_queries(std::vector<Value> const& sample, Rect const& bounds, std::size_t const total_points)
+{
+    std::vector<Rect> result;
+    if(sample.empty()) { return result; }
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    const double w = bounds.hx - bounds.lx;
+    const double h = bounds.hy - bounds.ly;
+
+    result.reserve(num_queries);
+    for(std::size_t q = 0; q < num_queries; ++q)
+    {
+        auto const& center = sample[rng() % sample.size()];
+
+        const auto fraction = std::min(1.0, std::pow(10.0, 5.0 * unit(rng)) / total_points);
+        const auto aspect = std::pow(2.0, 8.0 * unit(rng) - 4.0);
+
+        const auto half_w = 0.5 * w * std::sqrt(fraction * aspect);
+        const auto half_h = 0.5 * h * std::sqrt(fraction / aspect);
+
+        Rect r;
+        r.lx = static_cast<float>(center.x - half_w);
+        r.hx = static_cast<float>(center.x + half_w);
+        r.ly = static_cast<float>(center.y - half_h);
+        r.hy = static_cast<float>(center.y + half_h);
+        result.push_back(r);
+    }
+
+    return result;
+}
+
+// Seconds for search to run all of the queries, the best of a few rounds.
+template<typename Search>
+double time_queries(std::vector<Rect> const& queries, Search search)
+{
+    typedef std::chrono::high_res_clock clock;
+
+    double best = std::numeric_limits<double>::max();
+    for(int round = 0; round < 5; ++round)
+    {
+        const auto start = clock::now();
+        for(auto const& q : queries)
+        {
+            search(q);
+        }
+
+        best = std::min(best, std::chrono::duration<double>(clock::now() - start).count());
+    }
+
+    return best;
+}
+
+} // tuning
@@ -35,6 +35,13 @@ public:
     {
     }
 
+    // Only values with a rank up to and including max_rank_ are inserted.
+    min_constrained_iterator(Container& c, int32_t max_rank_)
+        : container(c)
+        , max_rank(max_rank_)
+    {
+    }
+
     inline min_con_iterator& operator=(value_type const& value)
     {
         insert_impl(value);
@@ -74,6 +81,13 @@ public:
 
     void clear() { container.clear(); }
 
+    // Starts over on the same container for another search.
+    void reset(int32_t max_rank_)
+    {
+        container.clear();
+        max_rank = max_rank_;
+    }
+
 protected:
     inline void move_max_to_back()
     {
@@ -86,9 +100,11 @@ protected:
         if(container._Mylast < container._Myend)  // size() < capacity()
         {
             container.push_back(value);
-            if(container._Mylast == container._Myend)  // size() < capacity()
+            if(container._Mylast == container._Myend)  // size() == capacity()
             {
+                // Full, only values ranked below the last one can still get in.
                 move_max_to_back();
+                max_rank = std::min(max_rank, container.back().rank);
             }
         }
         else if(value < container.back()) 
@@ -104,8 +120,51 @@ protected:
     int32_t max_rank;
 };
 
+// A back inserter iterator with the reporter interface that keeps every value.
+template<class Container>
+class unconstrained_iterator : 
+    public std::back_insert_iterator<Container>
+{
+public:
+    explicit unconstrained_iterator(Container& c)
+        : std::back_insert_iterator<Container>(c)
+    {
+    }
+
+    template<typename Type>
+    bool can_add(Type const&) const
+    {
+        return true;
+    }
+
+    int32_t get_max_rank() const
+    {
+        return std::numeric_limits<int32_t>::max();
+    }
+};
+
 template<class Container> inline
 min_constrained_iterator<Container> min_constrained_inserter(Container& cont)
 {
     return (min_constrained_iterator<Container>(cont));
 }
+
+template<class Container> inline
+min_constrained_iterator<Container> min_constrained_inserter(Container& cont, int32_t max_rank)
+{
+    return (min_constrained_iterator<Container>(cont, max_rank));
+}
+
+// Empties a container for a min_constrained_iterator to keep the count lowest values in.  The iterator is bounded by
+// the capacity, which reserve() never shrinks, so a larger one is released first.
+template<class Container> inline
+void reset_results(Container& results, std::size_t const count)
+{
+    results.clear();
+
+    if(results.capacity() != count)
+    {
+        Container().swap(results);
+    }
+    results.reserve(count);
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+//
+// A two stage model of the position of a key in a sorted sequence, to replace the binary search of large sorted
+// arrays.  The root maps a key linearly over the key range to one of the leaves, a leaf holds a line through its first
+// and last keys and the largest error of that line on its keys.
+//
+// A lookup predicts the position, checks that the answer is inside the error window around it and binary searches the
+// window, so it touches a leaf and one or two cache lines of keys where the binary search would touch about log2(n).
+// Keys the model was not trained on, or a window that misses, widen the window until it holds the answer, the result is
+// always the same as that of the binary search.
+//
+// The model does not keep the keys, the lookups take the same sequence and key function it was built with.
+//
+class LearnedIndex
+{
+public:
+    // Sequences shorter than this are binary searched, the model would not pay for itself.
+    static const std::size_t min_keys = 4096;
+
+    // Keys per leaf on average.
+    static const std::size_t keys_per_leaf = 64;
+
+    LearnedIndex() : m_min_key(0.0), m_scale(0.0), m_size(0) {}
+
+    template<typename Iterator, typename Key>
+    void build(Iterator first, Iterator last, Key key)
+    {
+        m_leaves.clear();
+        m_size = static_cast<std::size_t>(std::distance(first, last));
+        if(m_size < min_keys) { return; }
+
+        const double min_key = key(*first);
+        const double max_key = key(*(last - 1));
+        if(!(max_key > min_key)) { return; }
+
+        const auto num_leaves = m_size / keys_per_leaf;
+        m_min_key = min_key;
+        m_scale = num_leaves / (max_key - min_key);
+        m_leaves.resize(num_leaves);
+
+        // The keys of a leaf are contiguous, the root is monotone.  Fit each leaf on the first occurrence of its keys.
+        std::size_t i = 0;
+        for(std::size_t l = 0; l < num_leaves; ++l)
+        {
+            auto& leaf = m_leaves[l];
+
+            const auto begin = i;
+            while(i < m_size && leaf_of(key(first[i])) == l) { ++i; }
+
+            leaf.first = static_cast<uint32_t>(begin);
+            leaf.key = begin < m_size ? key(first[begin]) : static_cast<float>(max_key);
+            leaf.slope = 0.0f;
+            leaf.error = 0;
+
+            if(i - begin < 2) { continue; }
+
+            auto last_distinct = i - 1;
+            while(last_distinct > begin && key(first[last_distinct - 1]) == key(first[last_distinct])) { --last_distinct; }
+
+            const double span = static_cast<double>(key(first[last_distinct])) - leaf.key;
+            if(span > 0.0) { leaf.slope = static_cast<float>((last_distinct - begin) / span); }
+
+            std::size_t error = 0;
+            for(auto j = begin; j < i; ++j)
+            {
+                if(j > begin && key(first[j - 1]) == key(first[j])) { continue; }
+
+                const auto predicted = predict(leaf, key(first[j]));
+                error = std::max(error, predicted > j ? predicted - j : j - predicted);
+            }
+            leaf.error = static_cast<uint32_t>(error);
+        }
+    }
+
+    bool enabled() const { return !m_leaves.empty(); }
+
+    // std::lower_bound of v.
+    template<typename Iterator, typename Key>
+    Iterator lower_bound(Iterator first, Iterator last, float const v, Key key) const
+    {
+        return search(first, last, v, [&](typename std::iterator_traits<Iterator>::value_type const& e) { return key(e) < v; });
+    }
+
+    // std::upper_bound of v.
+    template<typename Iterator, typename Key>
+    Iterator upper_bound(Iterator first, Iterator last, float const v, Key key) const
+    {
+        return search(first, last, v, [&](typename std::iterator_traits<Iterator>::value_type const& e) { return !(v < key(e)); });
+    }
+
+    std::size_t size_in_bytes() const { return m_leaves.size() * sizeof(Leaf); }
+
+private:
+    struct Leaf
+    {
+        float key;          // First key of the leaf, or the key range end for an empty one.
+        float slope;        // Positions per unit of key.
+        uint32_t first;     // Position of key.
+        uint32_t error;     // Largest distance of a prediction from the position of a key of the leaf.
+    };
+
+    std::size_t leaf_of(double const v) const
+    {
+        const auto l = (v - m_min_key) * m_scale;
+        if(!(l > 0.0)) { return 0; }
+
+        return std::min(m_leaves.size() - 1, static_cast<std::size_t>(l));
+    }
+
+    std::size_t predict(Leaf const& leaf, float const v) const
+    {
+        const auto offset = std::max(0.0f, (v - leaf.key) * leaf.slope);
+
+        return std::min(m_size, leaf.first + static_cast<std::size_t>(offset + 0.5f));
+    }
+
+    // The partition point of before in [first, last).
+    template<typename Iterator, typename Before>
+    Iterator search(Iterator first, Iterator last, float const v, Before before) const
+    {
+        if(m_leaves.empty() || static_cast<std::size_t>(last - first) != m_size)
+        {
+            return std::partition_point(first, last, before);
+        }
+
+        auto const& leaf = m_leaves[leaf_of(v)];
+        const auto predicted = predict(leaf, v);
+
+        // Widen each side of the window until the answer is known to be inside.
+        std::size_t step = leaf.error + 1;
+        auto lo = predicted > step ? predicted - step : 0;
+        while(lo > 0 && !before(first[lo - 1]))
+        {
+            step *= 2;
+            lo = lo > step ? lo - step : 0;
+        }
+
+        step = leaf.error + 1;
+        auto hi = std::min(m_size, predicted + step);
+        while(hi < m_size && before(first[hi]))
+        {
+            step *= 2;
+            hi = std::min(m_size, hi + step);
+        }
+
+        return std::partition_point(first + lo, first + hi, before);
+    }
+
+private:
+    double m_min_key;
+    double m_scale;                 // Leaves per unit of key.
+    std::size_t m_size;             // Keys the model was built on.
+
+    std::vector<Leaf> m_leaves;
+};
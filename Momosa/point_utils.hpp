@@ -16,7 +16,11 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
+#include <vector>
+#include <ppl.h>
 #include "point_search.h"
 
 template<typename Point> inline bool operator<(Point const& lhs, Point const& rhs) { return lhs.rank < rhs.rank; }
@@ -96,4 +100,28 @@ template<std::size_t I> inline typename std::enable_if<I == 1, float>::type get_
 template<std::size_t I> inline typename std::enable_if<I == 1, float&>::type get_dim_coord_hi(Rect& r) { return r.hy; }
 
 template<std::size_t I, typename Point> inline typename std::enable_if<I == 0, float>::type get_dim_coord(Point const& p) { return static_cast<float>(p.x); }
-template<std::size_t I, typename Point> inline typename std::enable_if<I == 1, float>::type get_dim_coord(Point const& p) { return static_cast<float>(p.y); }
\ No newline at end of file
+template<std::size_t I, typename Point> inline typename std::enable_if<I == 1, float>::type get_dim_coord(Point const& p) { return static_cast<float>(p.y); }
+
+// Copies the points sorted by rank into points, without the ones beyond 1e9 in either coordinate, and splits them into
+// rank partitions like the r-tree partitions, but each twice the size of the one before.  Partition i holds the points
+// from starts[i] up to starts[i + 1].
+inline void doubling_rank_partitions(Point const* points_begin, Point const* points_end, std::size_t const first_partition_size,
+                                     std::vector<Point>& points, std::vector<std::size_t>& starts)
+{
+    points.clear();
+    starts.clear();
+
+    if(points_begin < points_end)
+    {
+        points.insert(points.begin(), points_begin, points_end);
+        points.erase(std::remove_if(points.begin(), points.end(), [](Point const& p){ return (std::abs(p.x) > 1.0e9 || std::abs(p.y) > 1.0e9); }  ), points.end());
+    }
+
+    concurrency::parallel_sort(points.begin(), points.end());
+
+    for(std::size_t start = 0, size = first_partition_size; start < points.size(); start += size, size *= 2)
+    {
+        starts.push_back(start);
+    }
+    starts.push_back(points.size());
+}
\ No newline at end of file
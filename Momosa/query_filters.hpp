@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "profile.hpp"
+
+//
+// Filters are pushed down into the tree queries.  accept_node() prunes a whole subtree from the summary kept in its
+// node, accept() tests a single point.  The upper rank bound is not a filter, it seeds the reporter's max rank so the
+// existing rank breakouts handle it.
+//
+
+// Set of Point::id values, one bit per id.
+struct id_set
+{
+    id_set() { bits[0] = bits[1] = bits[2] = bits[3] = 0; }
+
+    explicit id_set(uint64_t const* bits_)
+    {
+        bits[0] = bits_[0];
+        bits[1] = bits_[1];
+        bits[2] = bits_[2];
+        bits[3] = bits_[3];
+    }
+
+    void insert(int8_t id)
+    {
+        const auto i = static_cast<uint8_t>(id);
+        bits[i >> 6] |= uint64_t(1) << (i & 63);
+    }
+
+    bool contains(int8_t id) const
+    {
+        const auto i = static_cast<uint8_t>(id);
+        return (bits[i >> 6] & (uint64_t(1) << (i & 63))) != 0;
+    }
+
+    bool intersects(id_set const& other) const
+    {
+        return ((bits[0] & other.bits[0]) | (bits[1] & other.bits[1]) | (bits[2] & other.bits[2]) | (bits[3] & other.bits[3])) != 0;
+    }
+
+    void extend(id_set const& other)
+    {
+        bits[0] |= other.bits[0];
+        bits[1] |= other.bits[1];
+        bits[2] |= other.bits[2];
+        bits[3] |= other.bits[3];
+    }
+
+    uint64_t bits[4];
+};
+
+// Default filter, accepts everything.  Compiles away in the plain search.
+struct no_filter
+{
+    template<typename Node> bool accept_node(Node const&) const { return true; }
+    template<typename Value> bool accept(Value const&) const { return true; }
+};
+
+// Only accepts points with a rank of at least rank_lo.
+struct rank_range_filter
+{
+    explicit rank_range_filter(int32_t rank_lo_) : rank_lo(rank_lo_) {}
+
+    template<typename Node> bool accept_node(Node const& node) const { return node.max_rank >= rank_lo; }
+    template<typename Value> bool accept(Value const& value) const { return value.rank >= rank_lo; }
+
+    int32_t rank_lo;
+};
+
+// Only accepts points whose id is in the set.  Nodes keep the set of ids found in their subtree.
+struct id_filter
+{
+    explicit id_filter(id_set const& ids_) : ids(ids_) {}
+
+    template<typename Node> bool accept_node(Node const& node) const { return ids.intersects(node.ids); }
+    template<typename Value> bool accept(Value const& value) const { return ids.contains(value.id); }
+
+    id_set ids;
+};
+
+// Accepts everything until the deadline passes, then prunes every node so the search unwinds with the results found so
+// far.  The clock is only read once every check_interval calls.
+struct deadline_filter
+{
+    typedef std::chrono::high_res_clock clock;
+    static const uint32_t check_interval = 1024;
+
+    explicit deadline_filter(clock::time_point deadline_) : deadline(deadline_), checks(0), expired(false) {}
+
+    template<typename Node> bool accept_node(Node const&) const { return !has_expired(); }
+    template<typename Value> bool accept(Value const&) const { return true; }
+
+    bool has_expired() const
+    {
+        if(!expired && (++checks & (check_interval - 1)) == 0)
+        {
+            // Compare the tick counts, the rank comparisons in point_utils.hpp would make the time_point operators ambiguous.
+            expired = clock::now().time_since_epoch().count() >= deadline.time_since_epoch().count();
+        }
+
+        return expired;
+    }
+
+    clock::time_point deadline;
+    mutable uint32_t checks;
+    mutable bool expired;
+};
+
+// Loops that do not visit nodes, such as the linear slab search, poll this to stop early.
+template<typename Filter> bool has_expired(Filter const&) { return false; }
+inline bool has_expired(deadline_filter const& filter) { return filter.has_expired(); }
\ No newline at end of file
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include "learned_index.hpp"
+#include "point_utils.hpp"
+#include "regions.hpp"
+
+//
+// Rank space replaces each coordinate of a point by the number of points with a smaller coordinate on that axis.  A rect
+// maps to the rect of ranks with two binary searches per axis and the points inside are exactly the same, so engines
+// can be built and searched in rank space unchanged.  The ranks are whole numbers below 2^24 and held in the float
+// coordinates, which represent them exactly, so every compare in the trees and grids is exact.
+//
+// The points are spread evenly over [0, n) on both axes whatever their distribution, and the number of points inside a
+// slab is known exactly from its ranks.
+//
+// The binary searches go through a learned index of each axis, see learned_index.hpp.
+//
+class RankSpace
+{
+public:
+    // Number of points whose ranks are all exact in a float.
+    static const std::size_t max_points = std::size_t(1) << 24;
+
+    RankSpace() {}
+
+    // Returns false, leaving rank space disabled, if there are too many points.
+    template<typename Iterator>
+    bool build(Iterator first, Iterator last)
+    {
+        const auto num_points = static_cast<std::size_t>(std::distance(first, last));
+        if(num_points == 0 || num_points > max_points) { return false; }
+
+        m_coords[0].reserve(num_points);
+        m_coords[1].reserve(num_points);
+        for(; first != last; ++first)
+        {
+            m_coords[0].push_back(first->x);
+            m_coords[1].push_back(first->y);
+        }
+
+        std::sort(m_coords[0].begin(), m_coords[0].end());
+        std::sort(m_coords[1].begin(), m_coords[1].end());
+
+        m_index[0].build(m_coords[0].begin(), m_coords[0].end(), coord);
+        m_index[1].build(m_coords[1].begin(), m_coords[1].end(), coord);
+
+        return true;
+    }
+
+    bool enabled() const { return !m_coords[0].empty(); }
+
+    std::size_t size() const { return m_coords[0].size(); }
+
+    template<typename Value>
+    Value to_rank_space(Value value) const
+    {
+        value.x = static_cast<float>(lower_rank<0>(value.x));
+        value.y = static_cast<float>(lower_rank<1>(value.y));
+
+        return value;
+    }
+
+    template<typename Value>
+    Value from_rank_space(Value value) const
+    {
+        value.x = m_coords[0][static_cast<std::size_t>(value.x)];
+        value.y = m_coords[1][static_cast<std::size_t>(value.y)];
+
+        return value;
+    }
+
+    // The rect of the ranks of the points inside r.  It is empty, hx < lx or hy < ly, if no coordinate is in range.
+    Rect to_rank_space(Rect const& r) const
+    {
+        Rect result;
+        result.lx = static_cast<float>(lower_rank<0>(r.lx));
+        result.hx = static_cast<float>(upper_rank<0>(r.hx)) - 1.0f;
+        result.ly = static_cast<float>(lower_rank<1>(r.ly));
+        result.hy = static_cast<float>(upper_rank<1>(r.hy)) - 1.0f;
+
+        return result;
+    }
+
+    RectUnion to_rank_space(RectUnion const& r) const
+    {
+        // Rects holding no coordinate are dropped, they would only widen the bounds.
+        std::vector<Rect> rects;
+        rects.reserve(r.rects.size());
+        for(auto& rect : r.rects)
+        {
+            const auto ranks = to_rank_space(rect);
+            if(ranks.lx <= ranks.hx && ranks.ly <= ranks.hy) { rects.push_back(ranks); }
+        }
+
+        return RectUnion(rects.data(), rects.data() + rects.size());
+    }
+
+    // Only for rects of ranks of existing points, such as node mbrs.
+    Rect from_rank_space(Rect const& r) const
+    {
+        Rect result;
+        result.lx = m_coords[0][static_cast<std::size_t>(r.lx)];
+        result.hx = m_coords[0][static_cast<std::size_t>(r.hx)];
+        result.ly = m_coords[1][static_cast<std::size_t>(r.ly)];
+        result.hy = m_coords[1][static_cast<std::size_t>(r.hy)];
+
+        return result;
+    }
+
+    std::size_t size_in_bytes() const
+    {
+        return (m_coords[0].size() + m_coords[1].size()) * sizeof(float) + m_index[0].size_in_bytes() + m_index[1].size_in_bytes();
+    }
+
+private:
+    template<std::size_t I>
+    std::size_t lower_rank(float v) const
+    {
+        return static_cast<std::size_t>(m_index[I].lower_bound(m_coords[I].begin(), m_coords[I].end(), v, coord) - m_coords[I].begin());
+    }
+
+    template<std::size_t I>
+    std::size_t upper_rank(float v) const
+    {
+        return static_cast<std::size_t>(m_index[I].upper_bound(m_coords[I].begin(), m_coords[I].end(), v, coord) - m_coords[I].begin());
+    }
+
+    static float coord(float v) { return v; }
+
+private:
+    std::vector<float> m_coords[2];
+    LearnedIndex m_index[2];
+};
+
+// A region that cannot be mapped to rank space, such as a polygon, searched in rank space.  Node mbrs and points are
+// mapped back to be tested against the original region.
+template<typename Region>
+class RankSpaceRegion
+{
+public:
+    RankSpaceRegion(Region const& region_, RankSpace const& space_)
+        : region(region_)
+        , space(space_)
+        , bounds(space_.to_rank_space(get_bounds(region_)))
+    {
+    }
+
+    Region const& region;
+    RankSpace const& space;
+    Rect bounds;
+};
+
+template<typename Region> inline RankSpaceRegion<Region> to_rank_space(Region const& region, RankSpace const& space)
+{
+    return RankSpaceRegion<Region>(region, space);
+}
+
+inline Rect to_rank_space(Rect const& region, RankSpace const& space) { return space.to_rank_space(region); }
+inline RectUnion to_rank_space(RectUnion const& region, RankSpace const& space) { return space.to_rank_space(region); }
+
+template<typename Region> inline Rect const& get_bounds(RankSpaceRegion<Region> const& r) { return r.bounds; }
+
+template<typename Region> inline bool intersects(RankSpaceRegion<Region> const& a, Rect const& b)
+{
+    return intersects(a.bounds, b) && intersects(a.region, a.space.from_rank_space(b));
+}
+
+template<typename Region> inline bool contains(RankSpaceRegion<Region> const& a, Rect const& b)
+{
+    return contains(a.region, a.space.from_rank_space(b));
+}
+
+template<typename Region, typename Point> inline bool contains(RankSpaceRegion<Region> const& a, Point const& b)
+{
+    return contains(a.region, a.space.from_rank_space(b));
+}
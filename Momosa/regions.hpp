@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+#include "point_utils.hpp"
+
+//
+// Search regions other than a single Rect.  Each region provides the same intersects/contains overloads as Rect so
+// the tree queries can classify node mbrs as disjoint, intersecting or contained without knowing the region type.
+//
+
+// Union of rects, e.g. an L-shaped viewport.  A point inside several of the rects is still only visited once.
+class RectUnion
+{
+public:
+    RectUnion(Rect const* rects_begin, Rect const* rects_end)
+        : rects(rects_begin, rects_end)
+    {
+        initialize(bounds);
+        for(auto& r : rects)
+        {
+            extend_bounds(bounds, r);
+        }
+    }
+
+    std::vector<Rect> rects;
+    Rect bounds;
+};
+
+// Convex polygon stored as the half planes of its edges. A point is inside when nx*x + ny*y <= c for every edge.
+class ConvexPolygon
+{
+public:
+    struct Edge
+    {
+        double nx;
+        double ny;
+        double c;
+    };
+
+    // Vertices are x,y pairs in either winding order.  Repeated vertices are skipped.  Collinear vertices leave a pair
+    // of opposite edges, so the polygon is the segment between them, and vertices that all coincide leave no edges at
+    // all, so the polygon is just its bounds.
+    ConvexPolygon(float const* vertices, std::size_t num_vertices)
+    {
+        initialize(bounds);
+        if(num_vertices < 3) { return; }
+
+        double area = 0.0;
+        for(std::size_t i = 0; i < num_vertices; ++i)
+        {
+            const auto j = (i + 1) % num_vertices;
+            area += static_cast<double>(vertices[2*i]) * vertices[2*j+1] - static_cast<double>(vertices[2*j]) * vertices[2*i+1];
+        }
+
+        // Walk the vertices counter clockwise so the inside is on the left of every edge.
+        const auto step = area >= 0.0 ? 1 : num_vertices - 1;
+
+        edges.reserve(num_vertices);
+        for(std::size_t n = 0, i = 0; n < num_vertices; ++n, i = (i + step) % num_vertices)
+        {
+            const auto j = (i + step) % num_vertices;
+
+            const double x0 = vertices[2*i];
+            const double y0 = vertices[2*i+1];
+            const double x1 = vertices[2*j];
+            const double y1 = vertices[2*j+1];
+
+            if(x0 != x1 || y0 != y1)
+            {
+                Edge e;
+                e.nx = y1 - y0;
+                e.ny = x0 - x1;
+                e.c = e.nx * x0 + e.ny * y0;
+                edges.push_back(e);
+            }
+
+            if(bounds.lx > vertices[2*i]) bounds.lx = vertices[2*i];
+            if(bounds.hx < vertices[2*i]) bounds.hx = vertices[2*i];
+            if(bounds.ly > vertices[2*i+1]) bounds.ly = vertices[2*i+1];
+            if(bounds.hy < vertices[2*i+1]) bounds.hy = vertices[2*i+1];
+        }
+    }
+
+    std::vector<Edge> edges;
+    Rect bounds;
+};
+
+inline Rect const& get_bounds(Rect const& r) { return r; }
+inline Rect const& get_bounds(RectUnion const& r) { return r.bounds; }
+inline Rect const& get_bounds(ConvexPolygon const& r) { return r.bounds; }
+
+inline bool intersects(RectUnion const& a, Rect const& b)
+{
+    if(!intersects(a.bounds, b)) { return false; }
+
+    for(auto& r : a.rects)
+    {
+        if(intersects(r, b)) { return true; }
+    }
+
+    return false;
+}
+
+// Only reports containment by a single rect of the union, an mbr spanning several rects is treated as intersecting.
+inline bool contains(RectUnion const& a, Rect const& b)
+{
+    for(auto& r : a.rects)
+    {
+        if(contains(r, b)) { return true; }
+    }
+
+    return false;
+}
+
+template<typename Point> inline bool contains(RectUnion const& a, Point const& b)
+{
+    for(auto& r : a.rects)
+    {
+        if(contains(r, b)) { return true; }
+    }
+
+    return false;
+}
+
+// Separating axis test, exact for a convex polygon against a rect.  The rect axes are covered by the bounds test, the
+// polygon axes by checking whether the corner of b nearest to each edge is outside of it.
+inline bool intersects(ConvexPolygon const& a, Rect const& b)
+{
+    if(!intersects(a.bounds, b)) { return false; }
+
+    for(auto& e : a.edges)
+    {
+        const auto x = e.nx > 0.0 ? b.lx : b.hx;
+        const auto y = e.ny > 0.0 ? b.ly : b.hy;
+        if(e.nx * x + e.ny * y > e.c) { return false; }
+    }
+
+    return true;
+}
+
+// The polygon is convex, so it contains b if it contains the corner of b farthest out along each edge.  The bounds
+// are tested too, an edge-less polygon is only its bounds.
+inline bool contains(ConvexPolygon const& a, Rect const& b)
+{
+    if(!contains(a.bounds, b)) { return false; }
+
+    for(auto& e : a.edges)
+    {
+        const auto x = e.nx > 0.0 ? b.hx : b.lx;
+        const auto y = e.ny > 0.0 ? b.hy : b.ly;
+        if(e.nx * x + e.ny * y > e.c) { return false; }
+    }
+
+    return true;
+}
+
+template<typename Point> inline bool contains(ConvexPolygon const& a, Point const& b)
+{
+    if(!contains(a.bounds, b)) { return false; }
+
+    for(auto& e : a.edges)
+    {
+        if(e.nx * b.x + e.ny * b.y > e.c) { return false; }
+    }
+
+    return true;
+}
+
+// Tests a point that is already known to be inside the bounds of the region along dimension I, as in a linear search
+// of the points sorted by dimension I.
+template<std::size_t I, typename Point> inline bool contains_in_slab(Rect const& region, Point const& p)
+{
+    return within<(I + 1) % 2>(region, p);
+}
+
+template<std::size_t I, typename Region, typename Point> inline bool contains_in_slab(Region const& region, Point const& p)
+{
+    return contains(region, p);
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <iterator>
+#include <limits>
+
+#include "point_utils.hpp"
+
+//
+// How the tree builders pick where to split a node.
+//
+//   median      Count based median along the current dimension, the default.
+//   mean        Mean coordinate along the longest side of the bounds of the points.
+//   midpoint    Middle of the longest side of the bounds of the points.  Sliding midpoint, the split moves towards the
+//               points when one side would be empty.
+//   sah         Minimizes the expected number of child visits of a query of query_extent, (w + qw) * (h + qh) summed over
+//               the points of each side, over both dimensions.
+//   rank_aware  Like sah, but the lowest ranked quarter of the points counts four times, so the splits keep them in
+//               small subtrees.
+//
+// The split is rounded to a multiple of step, builders that pack their nodes only split between whole children.
+//
+enum class split_strategy { median, mean, midpoint, sah, rank_aware };
+
+struct split_options
+{
+    split_options() : strategy(split_strategy::median), query_extent(0.01f) { query_size[0] = query_size[1] = 0.0f; }
+    explicit split_options(split_strategy strategy_, float query_extent_ = 0.01f) : strategy(strategy_), query_extent(query_extent_) { query_size[0] = query_size[1] = 0.0f; }
+
+    // Sizes the expected query from the bounds of all of the points, builders call this before the first split.
+    void set_bounds(Rect const& bounds)
+    {
+        query_size[0] = query_extent * (bounds.hx - bounds.lx);
+        query_size[1] = query_extent * (bounds.hy - bounds.ly);
+    }
+
+    split_strategy strategy;
+    float query_extent;     // Expected side of a query as a fraction of the side of the bounds.
+    float query_size[2];
+};
+
+namespace split_detail {
+
+template<std::size_t I, typename Iter, typename Get>
+void sort_dimension(Iter first, Iter last, Get const& get)
+{
+    typedef typename std::iterator_traits<Iter>::value_type value_type;
+    std::sort(first, last, [&](value_type const& lhs, value_type const& rhs) { return get_dim_coord<I>(get(lhs)) < get_dim_coord<I>(get(rhs)); });
+}
+
+template<std::size_t I, typename Iter, typename Get>
+void nth_element_dimension(Iter first, Iter n, Iter last, Get const& get)
+{
+    typedef typename std::iterator_traits<Iter>::value_type value_type;
+    std::nth_element(first, n, last, [&](value_type const& lhs, value_type const& rhs) { return get_dim_coord<I>(get(lhs)) < get_dim_coord<I>(get(rhs)); });
+}
+
+template<typename Iter, typename Get>
+void nth_element_dimension(std::size_t dim, Iter first, Iter n, Iter last, Get const& get)
+{
+    if(dim == 0) { nth_element_dimension<0>(first, n, last, get); } else { nth_element_dimension<1>(first, n, last, get); }
+}
+
+inline float coord(Point const& p, std::size_t dim) { return dim == 0 ? p.x : p.y; }
+
+// Expected number of visits of a node of these bounds by a query of the given size.
+inline double visit_area(Rect const& r, float const query_size[2])
+{
+    if(r.hx < r.lx) { return 0.0; }
+
+    return (static_cast<double>(r.hx - r.lx) + query_size[0]) * (static_cast<double>(r.hy - r.ly) + query_size[1]);
+}
+
+} // split_detail
+
+//
+// Reorders [first, last) so the first m elements are the lower side of the split and returns m, a multiple of step in
+// [min_left, count - min_right], or 0 if there is none.  dim is the dimension to split, all strategies but median may
+// change it.  get maps an element to its point.
+//
+template<typename Iter, typename Get>
+std::size_t split_elements(Iter first, Iter last, std::size_t& dim, split_options const& options,
+                           std::size_t step, std::size_t min_left, std::size_t min_right, Get const& get)
+{
+    using namespace split_detail;
+
+    const auto count = static_cast<std::size_t>(std::distance(first, last));
+    if(count < min_left + min_right) { return 0; }
+
+    const auto lo = (min_left + step - 1) / step * step;
+    const auto hi = (count - min_right) / step * step;
+    if(lo == 0 || lo > hi) { return 0; }
+
+    // Nearest multiple of step in [lo, hi].
+    const auto snap = [&](std::size_t target) -> std::size_t
+    {
+        const auto m = (target + step / 2) / step * step;
+        return std::min(hi, std::max(lo, m));
+    };
+
+    std::size_t m = 0;
+
+    switch(options.strategy)
+    {
+    case split_strategy::median:
+        m = snap(count / 2);
+        break;
+
+    case split_strategy::mean:
+    case split_strategy::midpoint:
+        {
+            // Split along the longest side, cutting at any multiple of step along a fixed dimension would only reorder
+            // the same slabs of a packed node.
+            Rect bounds;
+            initialize(bounds);
+            for(auto it = first; it != last; ++it) { extend_bounds(bounds, get(*it)); }
+            dim = bounds.hx - bounds.lx >= bounds.hy - bounds.ly ? 0 : 1;
+
+            double split = 0.0;
+            if(options.strategy == split_strategy::mean)
+            {
+                for(auto it = first; it != last; ++it) { split += coord(get(*it), dim); }
+                split /= count;
+            }
+            else
+            {
+                split = dim == 0 ? 0.5 * (static_cast<double>(bounds.lx) + bounds.hx) : 0.5 * (static_cast<double>(bounds.ly) + bounds.hy);
+            }
+
+            std::size_t below = 0;
+            for(auto it = first; it != last; ++it)
+            {
+                if(coord(get(*it), dim) < split) { ++below; }
+            }
+
+            m = snap(below);
+        }
+        break;
+
+    case split_strategy::sah:
+    case split_strategy::rank_aware:
+        {
+            // Points of the lowest ranked quarter weigh four times as much.
+            int32_t low_rank = std::numeric_limits<int32_t>::lowest();
+            if(options.strategy == split_strategy::rank_aware)
+            {
+                std::vector<int32_t> ranks;
+                ranks.reserve(count);
+                for(auto it = first; it != last; ++it) { ranks.push_back(get(*it).rank); }
+                std::nth_element(ranks.begin(), ranks.begin() + count / 4, ranks.end());
+                low_rank = ranks[count / 4];
+            }
+
+            const auto weight = [&](Point const& p) -> double { return p.rank < low_rank ? 4.0 : 1.0; };
+
+            std::vector<Rect> suffix(count + 1);
+            std::vector<double> suffix_weight(count + 1);
+
+            double best_cost = std::numeric_limits<double>::max();
+            std::size_t best_dim = dim;
+
+            for(std::size_t d = 0; d < 2; ++d)
+            {
+                if(d == 0) { sort_dimension<0>(first, last, get); } else { sort_dimension<1>(first, last, get); }
+
+                initialize(suffix[count]);
+                suffix_weight[count] = 0.0;
+                for(auto i = count; i > 0; --i)
+                {
+                    auto const& p = get(*(first + (i - 1)));
+                    suffix[i - 1] = suffix[i];
+                    extend_bounds(suffix[i - 1], p);
+                    suffix_weight[i - 1] = suffix_weight[i] + weight(p);
+                }
+
+                Rect prefix;
+                initialize(prefix);
+                double prefix_weight = 0.0;
+                for(std::size_t i = 0; i < hi; ++i)
+                {
+                    auto const& p = get(*(first + i));
+                    extend_bounds(prefix, p);
+                    prefix_weight += weight(p);
+
+                    const auto split = i + 1;
+                    if(split < lo || split % step != 0) { continue; }
+
+                    const auto cost = visit_area(prefix, options.query_size) * prefix_weight + visit_area(suffix[split], options.query_size) * suffix_weight[split];
+                    if(cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_dim = d;
+                        m = split;
+                    }
+                }
+            }
+
+            // The elements are sorted along the last dimension tried.
+            if(best_dim != 1)
+            {
+                sort_dimension<0>(first, last, get);
+            }
+
+            dim = best_dim;
+            return m;
+        }
+    }
+
+    nth_element_dimension(dim, first, first + m, last, get);
+
+    return m;
+}
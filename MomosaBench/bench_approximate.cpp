@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bench_utils.hpp"
+#include "MomosaApi.hpp"
+#include "SearchContextImpl.hpp"
+
+//
+// Recall and speedup of search_approximate over the exact search, for several recall targets.  The exact results come
+// from SearchContextLinear.  The recall of a search is the fraction of the exact results it found, and is compared to
+// the estimate search_approximate reports.  The times are per query, over all of the queries and over the ones that
+// were cut short.
+//
+namespace {
+
+const int32_t top_count = 20;
+
+
+double recall_of(std::vector<int32_t> const& exact, Point const* found, int32_t const num_found)
+{
+    if(exact.empty()) { return 1.0; }
+
+    std::size_t hits = 0;
+    for(int32_t i = 0; i < num_found; ++i)
+    {
+        if(std::binary_search(exact.begin(), exact.end(), found[i].rank)) { ++hits; }
+    }
+
+    return static_cast<double>(hits) / exact.size();
+}
+
+// Best of a few rounds of each, the rounds alternate so both see the same cache and clock.
+template<typename Search, typename Approximate>
+void time_queries(std::vector<Rect> const& queries, Search search, Approximate approximate, double& search_time, double& approximate_time)
+{
+    search_time = std::numeric_limits<double>::max();
+    approximate_time = std::numeric_limits<double>::max();
+    if(queries.empty()) { return; }
+
+    for(int round = 0; round < 5; ++round)
+    {
+        auto start = bench::clock::now();
+        for(auto const& q : queries) { search(q); }
+        search_time = std::min(search_time, bench::seconds_since(start) / queries.size());
+
+        start = bench::clock::now();
+        for(auto const& q : queries) { approximate(q); }
+        approximate_time = std::min(approximate_time, bench::seconds_since(start) / queries.size());
+    }
+}
+
+} // namespace
+
+int bench_approximate(std::size_t const num_points)
+{
+    const bench::distribution distributions[] = { bench::distribution::uniform, bench::distribution::clustered };
+    const float recalls[] = { 0.5f, 0.8f, 0.9f, 0.95f, 1.0f };
+
+    for(auto d : distributions)
+    {
+        auto points = bench::make_points(num_points, d);
+        auto queries = bench::make_queries(points);
+        printf("approximate: %llu %s points, %llu queries, top %d\n", static_cast<unsigned long long>(num_points), bench::name(d), static_cast<unsigned long long>(queries.size()), top_count);
+
+        SearchContext* sc = create(points.data(), points.data() + points.size());
+        std::vector<Point> out(top_count);
+
+        std::vector<std::vector<int32_t>> exact(queries.size());
+        double linear_time = 0.0;
+        {
+            SearchContextLinear linear(points.data(), points.data() + points.size());
+            const auto start = bench::clock::now();
+            for(std::size_t q = 0; q < queries.size(); ++q)
+            {
+                const auto found = linear.search(queries[q], top_count, out.data());
+                for(int32_t i = 0; i < found; ++i) { exact[q].push_back(out[i].rank); }
+                std::sort(exact[q].begin(), exact[q].end());
+            }
+            linear_time = bench::seconds_since(start);
+        }
+
+        printf("  linear %.1fus per query\n", linear_time / queries.size() * 1e6);
+
+        for(auto target : recalls)
+        {
+            double recall = 0.0;
+            double estimate = 0.0;
+            double min_recall = 1.0;
+            int overestimated = 0;
+            std::vector<Rect> cut_short;
+
+            for(std::size_t q = 0; q < queries.size(); ++q)
+            {
+                float estimated = 0.0f;
+                const auto found = search_approximate(sc, queries[q], top_count, out.data(), target, &estimated);
+                const auto actual = recall_of(exact[q], out.data(), found);
+
+                recall += actual;
+                estimate += estimated;
+                min_recall = std::min(min_recall, actual);
+                if(estimated < 1.0f) { cut_short.push_back(queries[q]); }
+                if(estimated > actual + 0.05) { ++overestimated; }
+            }
+
+            const auto search_exact = [&](Rect const& r) { search(sc, r, top_count, out.data()); };
+            const auto search_approximated = [&](Rect const& r) { float estimated; search_approximate(sc, r, top_count, out.data(), target, &estimated); };
+
+            double search_time, approximate_time, cut_search_time, cut_approximate_time;
+            time_queries(queries, search_exact, search_approximated, search_time, approximate_time);
+            time_queries(cut_short, search_exact, search_approximated, cut_search_time, cut_approximate_time);
+
+            printf("  target %.2f  recall mean %.3f min %.3f  estimate mean %.3f  overestimated %3d  all %.1fus vs %.1fus  cut short %4llu",
+                target, recall / queries.size(), min_recall, estimate / queries.size(), overestimated,
+                approximate_time * 1e6, search_time * 1e6, static_cast<unsigned long long>(cut_short.size()));
+            if(!cut_short.empty()) { printf(" %.1fus vs %.1fus", cut_approximate_time * 1e6, cut_search_time * 1e6); }
+            printf("\n");
+        }
+
+        destroy(sc);
+    }
+
+    return 0;
+}
@@ -0,0 +1,417 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <thread>
+
+#include "bench_utils.hpp"
+#include "MomosaApi.hpp"
+#include "SearchContextImpl.hpp"
+
+//
+// Compares the searches against a brute force scan of the points.  Returns the number of mismatches, which are also
+// printed, the first few of each kind in full.
+//
+namespace {
+
+const int32_t max_count = 40;
+
+struct Checker
+{
+    Checker(const char* name_) : name(name_), queries(0), failures(0) {}
+
+    ~Checker()
+    {
+        printf("  %-28s %6d queries  %d failures\n", name, queries, failures);
+    }
+
+    void expect(std::vector<Point> const& expected, Point const* found, int32_t const num_found)
+    {
+        ++queries;
+        if(bench::same_ranks(expected.data(), static_cast<int32_t>(expected.size()), found, num_found)) { return; }
+
+        if(++failures <= 3)
+        {
+            printf("  %s query %d: found %d points, expected %llu\n", name, queries - 1, num_found, static_cast<unsigned long long>(expected.size()));
+        }
+    }
+
+    const char* name;
+    int queries;
+    int failures;
+};
+
+// The top "count" points that pass "inside".
+template<typename Inside>
+std::vector<Point> scan(std::vector<Point> const& sorted_points, int32_t const count, Inside inside)
+{
+    std::vector<Point> result;
+    for(auto const& p : sorted_points)
+    {
+        if(result.size() >= static_cast<std::size_t>(count)) { break; }
+        if(inside(p)) { result.push_back(p); }
+    }
+
+    return result;
+}
+
+// Inside the bounds of the vertices and on the same side of every edge, or on it.  Unlike the half planes of
+// ConvexPolygon this needs no winding order and holds for repeated and collinear vertices.
+bool inside_polygon(std::vector<float> const& v, Point const& p)
+{
+    const auto n = v.size() / 2;
+
+    Rect bounds;
+    initialize(bounds);
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        Point corner = { 0, 0, v[2*i], v[2*i+1] };
+        extend_bounds(bounds, corner);
+    }
+
+    if(!contains(bounds, p)) { return false; }
+
+    int positive = 0;
+    int negative = 0;
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        const auto j = (i + 1) % n;
+        const auto cross = (double(v[2*j]) - v[2*i]) * (double(p.y) - v[2*i+1]) - (double(v[2*j+1]) - v[2*i+1]) * (double(p.x) - v[2*i]);
+        if(cross > 0.0) { ++positive; }
+        if(cross < 0.0) { ++negative; }
+    }
+
+    return positive == 0 || negative == 0;
+}
+
+int check_rects(SearchContext* sc, SearchContextLinear& linear, std::vector<Rect> const& queries)
+{
+    Checker checker("search");
+    std::vector<Point> out(max_count);
+    std::vector<Point> expected(max_count);
+
+    for(std::size_t q = 0; q < queries.size(); ++q)
+    {
+        const auto count = 1 + static_cast<int32_t>(q % max_count);
+        const auto num_expected = linear.search(queries[q], count, expected.data());
+        const auto found = search(sc, queries[q], count, out.data());
+        checker.expect(std::vector<Point>(expected.begin(), expected.begin() + num_expected), out.data(), found);
+    }
+
+    return checker.failures;
+}
+
+int check_polygons(SearchContext* sc, std::vector<Point> const& sorted_points, std::mt19937& rng)
+{
+    Checker checker("search_polygon");
+    std::vector<Point> out(max_count);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    for(int q = 0; q < 400; ++q)
+    {
+        auto const& center = sorted_points[rng() % sorted_points.size()];
+        const auto num_vertices = 3 + static_cast<int>(rng() % 6);
+        const auto radius = unit(rng) * (q % 2 ? 20.0f : 300.0f);
+        const auto angle = unit(rng) * 6.2831853f;
+        const auto winding = q % 3 ? -1.0f : 1.0f;
+
+        std::vector<float> vertices;
+        for(int i = 0; i < num_vertices; ++i)
+        {
+            const auto a = angle + winding * 6.2831853f * i / num_vertices;
+            vertices.push_back(center.x + radius * std::cos(a));
+            vertices.push_back(center.y + radius * std::sin(a));
+        }
+
+        // Every few polygons repeat a vertex, collapse to a segment or to the single point of the center.
+        if(q % 4 == 1) { vertices.insert(vertices.begin(), vertices.begin(), vertices.begin() + 2); }
+        if(q % 8 == 2) { vertices.resize(6); vertices[4] = vertices[0]; vertices[5] = vertices[1]; }
+        if(q % 8 == 3) { vertices.assign(8, 0.0f); for(int i = 0; i < 4; ++i) { vertices[2*i] = center.x; vertices[2*i+1] = center.y; } }
+
+        const auto count = 1 + q % max_count;
+        const auto found = search_polygon(sc, vertices.data(), static_cast<int32_t>(vertices.size() / 2), count, out.data());
+        checker.expect(scan(sorted_points, count, [&](Point const& p) { return inside_polygon(vertices, p); }), out.data(), found);
+    }
+
+    return checker.failures;
+}
+
+// Points on the integer grid, many of the polygons lie exactly on its lines.
+int check_grid_polygons()
+{
+    std::vector<Point> points;
+    for(int32_t y = 0; y < 10; ++y)
+    {
+        for(int32_t x = 0; x < 20; ++x)
+        {
+            Point p = { 0, static_cast<int32_t>(points.size()), static_cast<float>(x), static_cast<float>(y) };
+            points.push_back(p);
+        }
+    }
+
+    SearchContext* sc = create(points.data(), points.data() + points.size());
+
+    Checker checker("search_polygon on a grid");
+    std::vector<Point> out(max_count);
+
+    const std::vector<std::vector<float>> polygons =
+    {
+        { 5, 5, 5, 5, 5, 5, 5, 5 },
+        { 5, 5, 5, 5, 5, 5 },
+        { 2, 3, 9, 3, 9, 3 },
+        { 2, 3, 9, 3, 5, 3 },
+        { 1, 1, 8, 8, 4, 4 },
+        { 0, 0, 0, 0, 6, 0, 6, 4, 0, 4, 0, 4 },
+        { 3, 1, 3, 1, 12, 1, 7, 8 },
+    };
+
+    for(auto const& vertices : polygons)
+    {
+        const auto found = search_polygon(sc, vertices.data(), static_cast<int32_t>(vertices.size() / 2), max_count, out.data());
+        checker.expect(scan(points, max_count, [&](Point const& p) { return inside_polygon(vertices, p); }), out.data(), found);
+    }
+
+    destroy(sc);
+    return checker.failures;
+}
+
+// An engine against the linear one, for the top 1, 20 and 100 points of each rect.
+template<typename Engine>
+int check_engine(std::vector<Point> const& points, std::vector<Rect> const& queries, const char* name)
+{
+    Checker checker(name);
+    Engine engine(points.data(), points.data() + points.size());
+    SearchContextLinear linear(points.data(), points.data() + points.size());
+
+    const int32_t counts[] = { 1, 20, 100 };
+    std::vector<Point> out(100);
+    std::vector<Point> expected(100);
+
+    for(auto const& r : queries)
+    {
+        for(auto count : counts)
+        {
+            const auto num_expected = linear.search(r, count, expected.data());
+            const auto found = engine.search(r, count, out.data());
+            checker.expect(std::vector<Point>(expected.begin(), expected.begin() + num_expected), out.data(), found);
+        }
+    }
+
+    return checker.failures;
+}
+
+// search_filtered of an engine against a scan, for sets of 1, 16 and 128 random ids.
+template<typename Engine>
+int check_filtered(std::vector<Point> const& sorted_points, std::vector<Rect> const& queries, const char* name)
+{
+    Checker checker(name);
+    Engine engine(sorted_points.data(), sorted_points.data() + sorted_points.size());
+
+    const int set_sizes[] = { 1, 16, 128 };
+    std::mt19937 rng(11);
+    std::vector<Point> out(max_count);
+
+    for(std::size_t q = 0; q < queries.size(); q += 8)
+    {
+        auto const& rect = queries[q];
+        const auto count = 1 + static_cast<int32_t>(q % max_count);
+
+        for(auto set_size : set_sizes)
+        {
+            id_set ids;
+            for(int i = 0; i < set_size; ++i) { ids.insert(static_cast<int8_t>(rng() % 256)); }
+
+            const auto expected = scan(sorted_points, count, [&](Point const& p) { return contains(rect, p) && ids.contains(p.id); });
+            const auto found = engine.search_filtered(rect, ids, count, out.data());
+            checker.expect(expected, out.data(), found);
+        }
+    }
+
+    return checker.failures;
+}
+
+// Many points with the same quantized coordinates span several Morton blocks.
+int check_morton_duplicates(std::vector<Point> const& points, std::vector<Rect> const& queries)
+{
+    std::vector<Point> stacked;
+    for(int32_t i = 0; i < 100; ++i)
+    {
+        Point p = { 0, i + 2, 5.0f, 5.0f };
+        stacked.push_back(p);
+    }
+
+    Point corners[] = { { 0, 0, 0.0f, 0.0f }, { 0, 1, 10.0f, 10.0f } };
+    stacked.insert(stacked.end(), corners, corners + 2);
+
+    const std::vector<Rect> stacked_queries = { { 4, 4, 6, 6 }, { 5, 5, 5, 5 }, { 0, 0, 5, 5 }, { 5, 5, 10, 10 }, { 0, 0, 10, 10 } };
+    auto failures = check_engine<SearchContextMorton>(stacked, stacked_queries, "morton on one coordinate");
+
+    // Snapped to a 64 x 64 grid, every cell holds many points.
+    auto snapped = points;
+    for(auto& p : snapped)
+    {
+        p.x = std::floor(p.x / 32.0f) * 32.0f;
+        p.y = std::floor(p.y / 32.0f) * 32.0f;
+    }
+
+    failures += check_engine<SearchContextMorton>(snapped, queries, "morton on a coarse grid");
+    return failures;
+}
+
+// Pages of every size up to max_count, through the first max_cursor_points points of each rect.
+int check_cursor(SearchContext* sc, std::vector<Point> const& sorted_points, std::vector<Rect> const& queries, const char* name)
+{
+    const int32_t max_cursor_points = 5000;
+
+    Checker checker(name);
+    std::vector<Point> found(max_cursor_points + max_count);
+
+    for(std::size_t q = 0; q < queries.size(); q += 4)
+    {
+        auto const& rect = queries[q];
+        const auto expected = scan(sorted_points, max_cursor_points, [&](Point const& p) { return contains(rect, p); });
+
+        SearchCursor* cursor = search_open(sc, rect);
+        const auto page = 1 + static_cast<int32_t>(q % max_count);
+
+        int32_t num_found = 0;
+        for(int32_t n = 1; n > 0 && num_found < max_cursor_points; num_found += n)
+        {
+            n = search_next(cursor, page, found.data() + num_found);
+        }
+
+        checker.expect(expected, found.data(), std::min(num_found, max_cursor_points));
+        search_close(cursor);
+    }
+
+    return checker.failures;
+}
+
+// A cursor open across a rebuild keeps paging through the points it was opened on, and holds up neither the rebuild
+// nor the next one.
+int check_cursor_rebuild(std::vector<Point> const& sorted_points, Rect const& rect)
+{
+    Checker checker("search_next across rebuilds");
+    const auto expected = scan(sorted_points, std::numeric_limits<int32_t>::max(), [&](Point const& p) { return contains(rect, p); });
+    const auto other_points = bench::make_points(sorted_points.size() / 2, bench::distribution::uniform, 43);
+
+    for(int destroy_first = 0; destroy_first < 2; ++destroy_first)
+    {
+        SearchContext* sc = create(sorted_points.data(), sorted_points.data() + sorted_points.size());
+        SearchCursor* cursor = search_open(sc, rect);
+
+        std::vector<Point> found(expected.size() + 1);
+        auto num_found = search_next(cursor, max_count, found.data());
+
+        const auto started = rebuild_async(sc, other_points.data(), other_points.data() + other_points.size());
+        if(destroy_first)
+        {
+            sc = destroy(sc);
+        }
+        else
+        {
+            rebuild_wait(sc);
+            if(!started || !rebuild_async(sc, sorted_points.data(), sorted_points.data() + sorted_points.size())) { ++checker.failures; }
+            rebuild_wait(sc);
+        }
+
+        for(int32_t n = 1; n > 0; num_found += n)
+        {
+            n = search_next(cursor, max_count, found.data() + num_found);
+        }
+
+        checker.expect(expected, found.data(), num_found);
+
+        search_close(cursor);
+        if(sc) { destroy(sc); }
+    }
+
+    return checker.failures;
+}
+
+// One thread starting rebuilds while another waits on them, as a refresh thread and a shutdown would.
+int check_rebuild_threads(std::vector<Point> const& sorted_points, Rect const& rect)
+{
+    Checker checker("rebuild_wait across threads");
+
+    const std::vector<Point> points(sorted_points.begin(), sorted_points.begin() + std::min<std::size_t>(sorted_points.size(), 20000));
+    const auto expected = scan(points, max_count, [&](Point const& p) { return contains(rect, p); });
+
+    SearchContext* sc = create(points.data(), points.data() + points.size());
+
+    std::atomic<bool> done(false);
+    std::thread waiter([&]() { while(!done) { rebuild_wait(sc); } });
+
+    for(int started = 0; started < 50; )
+    {
+        if(rebuild_async(sc, points.data(), points.data() + points.size())) { ++started; }
+    }
+
+    done = true;
+    waiter.join();
+    rebuild_wait(sc);
+
+    std::vector<Point> found(max_count);
+    checker.expect(expected, found.data(), search(sc, rect, max_count, found.data()));
+
+    destroy(sc);
+    return checker.failures;
+}
+
+} // namespace
+
+int bench_check(std::size_t const num_points)
+{
+    int failures = check_grid_polygons();
+
+    const bench::distribution distributions[] = { bench::distribution::uniform, bench::distribution::clustered };
+    for(auto d : distributions)
+    {
+        auto points = bench::make_points(num_points, d);
+        auto queries = bench::make_queries(points);
+        printf("check: %llu %s points\n", static_cast<unsigned long long>(num_points), bench::name(d));
+
+        SearchContext* sc = create(points.data(), points.data() + points.size());
+        SearchContextLinear linear(points.data(), points.data() + points.size());
+
+        std::sort(points.begin(), points.end(), [](Point const& a, Point const& b) { return a.rank < b.rank; });
+        std::mt19937 rng(7);
+
+        failures += check_rects(sc, linear, queries);
+        failures += check_polygons(sc, points, rng);
+        failures += check_cursor(sc, points, queries, "search_next");
+        failures += check_cursor_rebuild(points, queries[rng() % queries.size()]);
+        failures += check_rebuild_threads(points, queries[rng() % queries.size()]);
+        failures += check_engine<SearchContextMorton>(points, queries, "morton");
+        failures += check_engine<SearchContextRangeTree>(points, queries, "range tree");
+        failures += check_engine<SearchContextRangeTree>(points, bench::make_slabs(points, 0.01f, 400), "range tree on thin slabs");
+        failures += check_engine<SearchContextWavelet>(points, queries, "wavelet");
+        failures += check_engine<SearchContextImplicitKdTree>(points, queries, "implicit kd-tree");
+        failures += check_filtered<SearchContextImplicitKdTree>(points, queries, "implicit kd-tree filtered");
+        failures += check_morton_duplicates(points, queries);
+
+        destroy(sc);
+
+        // Hybrid partitions page the grid and flat partitions next to the R-tree ones.
+        sc = create_ex(points.data(), points.data() + points.size(), MOMOSA_BUILD_HYBRID_PARTITIONS);
+        failures += check_rects(sc, linear, queries);
+        failures += check_cursor(sc, points, queries, "search_next hybrid");
+        destroy(sc);
+    }
+
+    printf("%d failures\n", failures);
+    return failures != 0;
+}
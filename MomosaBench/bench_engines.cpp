@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bench_utils.hpp"
+#include "SearchContextImpl.hpp"
+
+//
+// Latency of the engines that SearchContext does not use, next to SearchContextRTree.  Each is timed on the auto tuning
+// query mix and on thin slabs across the whole extent of the points, which hit nearly every node of a tree while
+// holding few points.  The engines that report their size also print it per point.  bench_check compares their
+// results with the linear scan.
+//
+namespace {
+
+const int32_t top_count = 20;
+const std::size_t num_slabs = 1000;
+const float slab_widths[] = { 0.001f, 0.01f, 0.05f };
+
+// Best of a few rounds, per query.
+template<typename Engine>
+double time_queries(Engine& engine, std::vector<Rect> const& queries)
+{
+    std::vector<Point> out(top_count);
+    double best = std::numeric_limits<double>::max();
+
+    for(int round = 0; round < 3; ++round)
+    {
+        const auto start = bench::clock::now();
+        for(auto const& q : queries) { engine.search(q, top_count, out.data()); }
+        best = std::min(best, bench::seconds_since(start));
+    }
+
+    return best / queries.size();
+}
+
+template<typename Engine>
+void run(const char* name, std::vector<Point> const& points, std::vector<Rect> const& mix, std::vector<std::vector<Rect>> const& slabs,
+         std::size_t (Engine::*size_in_bytes)() const = nullptr)
+{
+    const auto start = bench::clock::now();
+    Engine engine(points.data(), points.data() + points.size());
+    const auto build_time = bench::seconds_since(start);
+
+    printf("  %-12s build %6.2fs  mix %8.1fus  slabs", name, build_time, time_queries(engine, mix) * 1e6);
+    for(auto const& s : slabs) { printf(" %8.1fus", time_queries(engine, s) * 1e6); }
+    if(size_in_bytes) { printf("  %.1f bytes per point", static_cast<double>((engine.*size_in_bytes)()) / points.size()); }
+    printf("\n");
+}
+
+} // namespace
+
+int bench_engines(std::size_t const num_points)
+{
+    const bench::distribution distributions[] = { bench::distribution::uniform, bench::distribution::normal, bench::distribution::clustered };
+
+    for(auto d : distributions)
+    {
+        const auto points = bench::make_points(num_points, d);
+        const auto mix = bench::make_queries(points);
+
+        std::vector<std::vector<Rect>> slabs;
+        for(auto width : slab_widths) { slabs.push_back(bench::make_slabs(points, width, num_slabs)); }
+
+        printf("engines: %llu %s points, top %d, slabs %.3f %.3f %.3f of the extent across\n", static_cast<unsigned long long>(num_points),
+            bench::name(d), top_count, slab_widths[0], slab_widths[1], slab_widths[2]);
+
+        run<SearchContextRTree>("rtree", points, mix, slabs);
+        run<SearchContextRangeTree>("range tree", points, mix, slabs);
+        run<SearchContextWavelet>("wavelet", points, mix, slabs, &SearchContextWavelet::size_in_bytes);
+    }
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bench_utils.hpp"
+#include "MomosaApi.hpp"
+
+#include <atomic>
+#include <thread>
+
+//
+// Latency of searches before, during and after a rebuild_async of the same size.  The searches run on their own thread
+// while the main thread waits for the rebuild, so they compete with the build for the cores.
+//
+static std::vector<double> run_queries(SearchContext* sc, std::vector<Rect> const& queries, std::atomic<bool> const* stop, std::size_t const min_queries)
+{
+    std::vector<double> latencies;
+    std::vector<Point> out(20);
+
+    for(std::size_t i = 0; i < min_queries || (stop && !*stop); ++i)
+    {
+        const auto start = bench::clock::now();
+        search(sc, queries[i % queries.size()], 20, out.data());
+        latencies.push_back(bench::seconds_since(start));
+    }
+
+    return latencies;
+}
+
+static void report(const char* phase, std::vector<double> latencies)
+{
+    const auto p50 = bench::percentile(latencies, 0.5);
+    const auto p99 = bench::percentile(latencies, 0.99);
+    const auto p999 = bench::percentile(latencies, 0.999);
+
+    printf("  %-8s %8llu queries  p50 %8.1fus  p99 %8.1fus  p99.9 %8.1fus  max %8.1fus\n", phase, static_cast<unsigned long long>(latencies.size()),
+        p50 * 1e6, p99 * 1e6, p999 * 1e6, latencies.back() * 1e6);
+}
+
+int bench_rebuild(std::size_t const num_points)
+{
+    auto points = bench::make_points(num_points, bench::distribution::uniform, 42);
+    auto next_points = bench::make_points(num_points, bench::distribution::uniform, 43);
+    auto queries = bench::make_queries(points);
+
+    printf("rebuild: %llu points, %u hardware threads\n", static_cast<unsigned long long>(num_points), std::thread::hardware_concurrency());
+
+    auto start = bench::clock::now();
+    SearchContext* sc = create(points.data(), points.data() + points.size());
+    printf("  create   %.2fs\n", bench::seconds_since(start));
+
+    report("idle", run_queries(sc, queries, nullptr, 20 * queries.size()));
+
+    std::atomic<bool> published(false);
+    std::vector<double> during;
+    std::thread searches([&] { during = run_queries(sc, queries, &published, queries.size()); });
+
+    start = bench::clock::now();
+    rebuild_async(sc, next_points.data(), next_points.data() + next_points.size());
+    rebuild_wait(sc);
+    const auto rebuild_time = bench::seconds_since(start);
+
+    published = true;
+    searches.join();
+
+    printf("  rebuild  %.2fs\n", rebuild_time);
+    report("during", during);
+    report("after", run_queries(sc, queries, nullptr, 20 * queries.size()));
+
+    destroy(sc);
+    return 0;
+}
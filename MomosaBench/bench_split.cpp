@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+
+#include "bench_utils.hpp"
+#include "KdTree.hpp"
+#include "RTree.hpp"
+#include "iterators.hpp"
+#include "query_filters.hpp"
+#include "SearchContextImpl.hpp"
+
+//
+// Node visits and latency of the split strategies, for the R-tree and the k-d tree.  The trees are built over rank
+// partitions of the same size as the search contexts use, and searched in rank order for the top points of the auto
+// tuning query mix.  A node visit is a call to accept_node, so a node pruned by its rank or by the rect still counts.
+// The results are compared to SearchContextLinear.
+//
+namespace {
+
+const int32_t top_count = 20;
+
+const split_strategy strategies[] = { split_strategy::median, split_strategy::mean, split_strategy::midpoint, split_strategy::sah, split_strategy::rank_aware };
+
+const char* name(split_strategy const s)
+{
+    switch(s)
+    {
+    case split_strategy::median: return "median";
+    case split_strategy::mean: return "mean";
+    case split_strategy::midpoint: return "midpoint";
+    case split_strategy::sah: return "sah";
+    default: return "rank_aware";
+    }
+}
+
+struct counting_filter
+{
+    explicit counting_filter(std::size_t& visits_) : visits(&visits_) {}
+
+    template<typename Node> bool accept_node(Node const&) const { ++*visits; return true; }
+    template<typename Value> bool accept(Value const&) const { return true; }
+
+    std::size_t* visits;
+};
+
+typedef RTree<Point, rtree_dynamic_parameters> rtree_t;
+
+struct rtree_partitions
+{
+    static const char* engine() { return "rtree"; }
+    static std::size_t partition_size() { return EngineParameters().partition_size; }
+
+    static std::unique_ptr<rtree_t> make(std::vector<Point>::iterator first, std::vector<Point>::iterator last, split_options const& split)
+    {
+        const EngineParameters parameters;
+        return std::unique_ptr<rtree_t>(new rtree_t(first, last, rtree_dynamic_parameters(parameters.max_leaf_elements, parameters.max_elements), split));
+    }
+
+    template<typename Filter>
+    static void query(rtree_t& tree, Rect const& rect, min_constrained_iterator<std::vector<Point>>& out_it, Filter const& filter)
+    {
+        tree.query(rect, out_it, filter);
+    }
+};
+
+struct kdtree_partitions
+{
+    static const char* engine() { return "kdtree"; }
+    static std::size_t partition_size() { return 16383; }
+
+    static std::unique_ptr<KdTree> make(std::vector<Point>::iterator first, std::vector<Point>::iterator last, split_options const& split)
+    {
+        return std::unique_ptr<KdTree>(new KdTree(first, last, split));
+    }
+
+    template<typename Filter>
+    static void query(KdTree& tree, Rect const& rect, min_constrained_iterator<std::vector<Point>>& out_it, Filter const& filter)
+    {
+        tree.query(rect, out_it, filter);
+    }
+};
+
+// The top points of the rect over the partitions in rank order, stopping once the results are full.
+template<class Engine, typename Tree, typename Filter>
+void search(std::vector<std::unique_ptr<Tree>>& trees, Rect const& rect, std::vector<Point>& results, Filter const& filter)
+{
+    results.clear();
+    results.reserve(top_count);
+    auto out_it = min_constrained_inserter(results);
+
+    for(auto& tree : trees)
+    {
+        if(results.size() >= static_cast<std::size_t>(top_count)) { break; }
+        Engine::query(*tree, rect, out_it, filter);
+    }
+
+    std::sort(results.begin(), results.end(), [](Point const& lhs, Point const& rhs) { return lhs.rank < rhs.rank; });
+}
+
+template<class Engine>
+void run(std::vector<Point> points, std::vector<Rect> const& queries, std::vector<std::vector<Point>> const& exact)
+{
+    typedef typename std::remove_reference<decltype(*Engine::make(points.begin(), points.end(), split_options()))>::type tree_t;
+
+    std::sort(points.begin(), points.end(), [](Point const& lhs, Point const& rhs) { return lhs.rank < rhs.rank; });
+
+    for(auto s : strategies)
+    {
+        std::vector<std::unique_ptr<tree_t>> trees;
+
+        const auto build_start = bench::clock::now();
+        for(std::size_t first = 0; first < points.size(); first += Engine::partition_size())
+        {
+            const auto last = std::min(points.size(), first + Engine::partition_size());
+            trees.push_back(Engine::make(points.begin() + first, points.begin() + last, split_options(s)));
+        }
+        const auto build_time = bench::seconds_since(build_start);
+
+        std::vector<Point> results;
+        std::size_t visits = 0;
+        int failures = 0;
+        for(std::size_t q = 0; q < queries.size(); ++q)
+        {
+            search<Engine>(trees, queries[q], results, counting_filter(visits));
+            if(!bench::same_ranks(results.data(), static_cast<int32_t>(results.size()), exact[q].data(), static_cast<int32_t>(exact[q].size()))) { ++failures; }
+        }
+
+        double query_time = std::numeric_limits<double>::max();
+        for(int round = 0; round < 3; ++round)
+        {
+            const auto start = bench::clock::now();
+            for(auto const& q : queries) { search<Engine>(trees, q, results, no_filter()); }
+            query_time = std::min(query_time, bench::seconds_since(start) / queries.size());
+        }
+
+        printf("  %-6s %-10s  build %6.2fs  visits %8.1f per query  %7.1fus per query%s\n", Engine::engine(), name(s),
+            build_time, static_cast<double>(visits) / queries.size(), query_time * 1e6, failures ? "  FAILED" : "");
+        if(failures) { printf("    %d of %llu queries differ from the linear scan\n", failures, static_cast<unsigned long long>(queries.size())); }
+    }
+}
+
+} // namespace
+
+int bench_split(std::size_t const num_points)
+{
+    const bench::distribution distributions[] = { bench::distribution::uniform, bench::distribution::normal, bench::distribution::clustered };
+
+    for(auto d : distributions)
+    {
+        const auto points = bench::make_points(num_points, d);
+        const auto queries = bench::make_queries(points);
+        printf("split: %llu %s points, %llu queries, top %d\n", static_cast<unsigned long long>(num_points), bench::name(d), static_cast<unsigned long long>(queries.size()), top_count);
+
+        std::vector<std::vector<Point>> exact(queries.size());
+        {
+            SearchContextLinear linear(points.data(), points.data() + points.size());
+            for(std::size_t q = 0; q < queries.size(); ++q)
+            {
+                exact[q].resize(top_count);
+                exact[q].resize(linear.search(queries[q], top_count, exact[q].data()));
+            }
+        }
+
+        run<rtree_partitions>(points, queries, exact);
+        run<kdtree_partitions>(points, queries, exact);
+    }
+
+    return 0;
+}
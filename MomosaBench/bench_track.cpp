@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bench_utils.hpp"
+#include "MomosaApi.hpp"
+
+//
+// Replays viewport traces of a panning and zooming map client through track_update and through independent searches.
+// Each step pans by 1 to 10% of the viewport, or zooms in or out by up to 10%, and one in 50 jumps somewhere else.
+//
+namespace {
+
+const int num_traces = 100;
+const int trace_length = 100;
+const int32_t top_count = 20;
+
+std::vector<Rect> make_trace(std::vector<Point> const& points, Rect const& bounds, double const fraction, std::mt19937& rng)
+{
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    const auto half_w = 0.5 * (bounds.hx - bounds.lx) * std::sqrt(fraction);
+    const auto half_h = 0.5 * (bounds.hy - bounds.ly) * std::sqrt(fraction);
+
+    auto const* center = &points[rng() % points.size()];
+    double x = center->x;
+    double y = center->y;
+    double zoom = 1.0;
+
+    std::vector<Rect> trace;
+    for(int step = 0; step < trace_length; ++step)
+    {
+        const auto kind = rng() % 50;
+        if(kind == 0)
+        {
+            center = &points[rng() % points.size()];
+            x = center->x;
+            y = center->y;
+        }
+        else if(kind < 35)
+        {
+            const auto angle = unit(rng) * 6.2831853;
+            const auto distance = 0.01 + 0.09 * unit(rng);
+            x += std::cos(angle) * distance * 2.0 * half_w * zoom;
+            y += std::sin(angle) * distance * 2.0 * half_h * zoom;
+        }
+        else
+        {
+            zoom *= 0.9 + 0.2 * unit(rng);
+        }
+
+        Rect r;
+        r.lx = static_cast<float>(x - half_w * zoom);
+        r.hx = static_cast<float>(x + half_w * zoom);
+        r.ly = static_cast<float>(y - half_h * zoom);
+        r.hy = static_cast<float>(y + half_h * zoom);
+        trace.push_back(r);
+    }
+
+    return trace;
+}
+
+} // namespace
+
+int bench_track(std::size_t const num_points)
+{
+    const bench::distribution distributions[] = { bench::distribution::uniform, bench::distribution::clustered };
+    const double fractions[] = { 1e-6, 1e-5, 1e-4, 1e-3, 1e-2 };
+
+    int failures = 0;
+    for(auto d : distributions)
+    {
+        auto points = bench::make_points(num_points, d);
+        printf("track: %llu %s points, %d traces of %d rects, top %d\n", static_cast<unsigned long long>(num_points), bench::name(d), num_traces, trace_length, top_count);
+
+        Rect bounds;
+        initialize(bounds);
+        for(auto const& p : points) { extend_bounds(bounds, p); }
+
+        SearchContext* sc = create(points.data(), points.data() + points.size());
+
+        std::vector<Point> out(top_count);
+
+        for(auto fraction : fractions)
+        {
+            std::mt19937 rng(7);
+            std::vector<double> track_latencies;
+            std::vector<double> search_latencies;
+
+            for(int t = 0; t < num_traces; ++t)
+            {
+                const auto trace = make_trace(points, bounds, fraction, rng);
+
+                // Each pass leaves the cache warm for the other, so they take turns going first.
+                std::vector<std::vector<Point>> tracked_results;
+                std::vector<std::vector<Point>> searched_results;
+                for(int pass = 0; pass < 2; ++pass)
+                {
+                    if((pass + t) % 2 == 0)
+                    {
+                        TrackSession* session = track_begin(sc);
+                        for(auto const& r : trace)
+                        {
+                            const auto start = bench::clock::now();
+                            const auto found = track_update(session, r, top_count, out.data());
+                            track_latencies.push_back(bench::seconds_since(start));
+                            tracked_results.emplace_back(out.begin(), out.begin() + found);
+                        }
+                        track_end(session);
+                    }
+                    else
+                    {
+                        for(auto const& r : trace)
+                        {
+                            const auto start = bench::clock::now();
+                            const auto found = search(sc, r, top_count, out.data());
+                            search_latencies.push_back(bench::seconds_since(start));
+                            searched_results.emplace_back(out.begin(), out.begin() + found);
+                        }
+                    }
+                }
+
+                for(std::size_t i = 0; i < trace.size(); ++i)
+                {
+                    auto const& a = tracked_results[i];
+                    auto const& b = searched_results[i];
+                    if(!bench::same_ranks(a.data(), static_cast<int32_t>(a.size()), b.data(), static_cast<int32_t>(b.size()))) { ++failures; }
+                }
+            }
+
+            double track_total = 0.0;
+            double search_total = 0.0;
+            for(auto s : track_latencies) { track_total += s; }
+            for(auto s : search_latencies) { search_total += s; }
+
+            const auto track_p99 = bench::percentile(track_latencies, 0.99);
+            const auto search_p99 = bench::percentile(search_latencies, 0.99);
+
+            printf("  viewport %-6g of bounds  track mean %7.1fus p99 %7.1fus  search mean %7.1fus p99 %7.1fus  speedup %.2f\n",
+                fraction, track_total / track_latencies.size() * 1e6, track_p99 * 1e6,
+                search_total / search_latencies.size() * 1e6, search_p99 * 1e6, search_total / track_total);
+        }
+
+        destroy(sc);
+    }
+
+    printf("%d mismatches against search\n", failures);
+    return failures != 0;
+}
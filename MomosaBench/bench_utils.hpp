@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "point_search.h"
+#include "auto_tune.hpp"
+
+//
+// Workloads and timing shared by the benchmarks.  The points are uniquely ranked like the ones of the original task,
+// the queries are the synthetic mix the auto tuning times its candidates on.
+//
+namespace bench {
+
+typedef std::chrono::high_resolution_clock clock;
+
+enum class distribution { uniform, normal, clustered };
+
+inline const char* name(distribution const d)
+{
+    switch(d)
+    {
+    case distribution::uniform: return "uniform";
+    case distribution::normal: return "normal";
+    default: return "clustered";
+    }
+}
+
+inline std::vector<Point> make_points(std::size_t const num_points, distribution const d, unsigned const seed = 42)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uniform(-1000.0f, 1000.0f);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+
+    std::vector<std::pair<float, float>> centers(20);
+    for(auto& c : centers) { c = std::make_pair(uniform(rng), uniform(rng)); }
+
+    std::vector<int32_t> ranks(num_points);
+    for(std::size_t i = 0; i < num_points; ++i) { ranks[i] = static_cast<int32_t>(i); }
+    std::shuffle(ranks.begin(), ranks.end(), rng);
+
+    std::vector<Point> points(num_points);
+    for(std::size_t i = 0; i < num_points; ++i)
+    {
+        auto& p = points[i];
+        p.id = static_cast<int8_t>(rng() % 256);
+        p.rank = ranks[i];
+
+        switch(d)
+        {
+        case distribution::uniform:
+            p.x = uniform(rng);
+            p.y = uniform(rng);
+            break;
+        case distribution::normal:
+            p.x = normal(rng) * 300.0f;
+            p.y = normal(rng) * 300.0f;
+            break;
+        case distribution::clustered:
+        {
+            auto const& c = centers[rng() % centers.size()];
+            p.x = c.first + normal(rng) * 20.0f;
+            p.y = c.second + normal(rng) * 5.0f;
+            break;
+        }
+        }
+    }
+
+    return points;
+}
+
+// The auto tuning query mix over the points, 1 to 100000 expected points per rect.
+inline std::vector<Rect> make_queries(std::vector<Point> const& points)
+{
+    Rect bounds;
+    initialize(bounds);
+    for(auto const& p : points) { extend_bounds(bounds, p); }
+
+    return tuning::make_queries(points, bounds, points.size());
+}
+
+// Slabs across the whole extent of the points, vertical and horizontal in turn, each "width" times the extent across
+// and centered on one of the points.
+inline std::vector<Rect> make_slabs(std::vector<Point> const& points, float const width, std::size_t const num_slabs, unsigned const seed = 7)
+{
+    Rect bounds;
+    initialize(bounds);
+    for(auto const& p : points) { extend_bounds(bounds, p); }
+
+    const auto half_x = 0.5f * width * (bounds.hx - bounds.lx);
+    const auto half_y = 0.5f * width * (bounds.hy - bounds.ly);
+
+    std::mt19937 rng(seed);
+    std::vector<Rect> slabs(num_slabs);
+    for(std::size_t i = 0; i < num_slabs; ++i)
+    {
+        auto const& c = points[rng() % points.size()];
+        if(i % 2 == 0)
+        {
+            slabs[i].lx = c.x - half_x;
+            slabs[i].ly = bounds.ly;
+            slabs[i].hx = c.x + half_x;
+            slabs[i].hy = bounds.hy;
+        }
+        else
+        {
+            slabs[i].lx = bounds.lx;
+            slabs[i].ly = c.y - half_y;
+            slabs[i].hx = bounds.hx;
+            slabs[i].hy = c.y + half_y;
+        }
+    }
+
+    return slabs;
+}
+
+inline double seconds_since(clock::time_point const start)
+{
+    return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+// The "p" quantile of the samples, which are sorted in place.
+inline double percentile(std::vector<double>& samples, double const p)
+{
+    if(samples.empty()) { return 0.0; }
+
+    std::sort(samples.begin(), samples.end());
+    const auto i = static_cast<std::size_t>(p * (samples.size() - 1) + 0.5);
+    return samples[i];
+}
+
+// True if both hold the same ranks in the same order.
+inline bool same_ranks(Point const* a, int32_t const num_a, Point const* b, int32_t const num_b)
+{
+    if(num_a != num_b) { return false; }
+
+    for(int32_t i = 0; i < num_a; ++i)
+    {
+        if(a[i].rank != b[i].rank) { return false; }
+    }
+
+    return true;
+}
+
+} // bench
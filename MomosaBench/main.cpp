@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2015 Patrick Moore
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+int bench_approximate(std::size_t const num_points);
+int bench_check(std::size_t const num_points);
+int bench_engines(std::size_t const num_points);
+int bench_rebuild(std::size_t const num_points);
+int bench_split(std::size_t const num_points);
+int bench_track(std::size_t const num_points);
+
+struct Command
+{
+    const char* name;
+    int (*run)(std::size_t const num_points);
+    std::size_t default_points;
+    const char* description;
+};
+
+static const Command commands[] =
+{
+    { "approximate", bench_approximate, 10000000, "recall and speedup of search_approximate against the exact results" },
+    { "check", bench_check, 1000000, "compare the searches against a brute force scan" },
+    { "engines", bench_engines, 2000000, "latency of the other engines next to the r-tree, on the query mix and thin slabs" },
+    { "rebuild", bench_rebuild, 10000000, "search latency before, during and after rebuild_async" },
+    { "split", bench_split, 2000000, "node visits and latency of the tree split strategies" },
+    { "track", bench_track, 10000000, "pan and zoom traces through track_update and through search" },
+};
+
+int main(int argc, char** argv)
+{
+    for(auto const& command : commands)
+    {
+        if(argc > 1 && strcmp(argv[1], command.name) == 0)
+        {
+            const std::size_t num_points = argc > 2 ? strtoul(argv[2], nullptr, 10) : command.default_points;
+            return command.run(num_points);
+        }
+    }
+
+    printf("usage: MomosaBench <command> [num_points]\n");
+    for(auto const& command : commands)
+    {
+        printf("  %-12s %s, %llu points by default\n", command.name, command.description, static_cast<unsigned long long>(command.default_points));
+    }
+
+    return 1;
+}